@@ -41,6 +41,7 @@ import java.util.HashMap;
 import java.util.Map;
 import java.util.Set;
 import java.lang.ref.WeakReference;
+import java.nio.ByteBuffer;
 
 /**
  * MediaPlayer class can be used to control playback
@@ -1110,6 +1111,55 @@ public class FFmpegMediaPlayer
      */
     public native void seekTo(int msec) throws IllegalStateException;
 
+    /**
+     * Seek mode used with {@link #seekTo(long, int)}: resume from the sync
+     * (key) frame at or before the given time. This is what
+     * {@link #seekTo(int)} does.
+     */
+    public static final int SEEK_PREVIOUS_SYNC = 0x00;
+    /**
+     * Seek mode used with {@link #seekTo(long, int)}: resume from the sync
+     * (key) frame at or after the given time.
+     */
+    public static final int SEEK_NEXT_SYNC = 0x01;
+    /**
+     * Seek mode used with {@link #seekTo(long, int)}: resume from the sync
+     * (key) frame nearest to the given time. The cheapest seek.
+     */
+    public static final int SEEK_CLOSEST_SYNC = 0x02;
+    /**
+     * Seek mode used with {@link #seekTo(long, int)}: resume exactly at the
+     * given time. The player decodes from the sync frame before it and drops
+     * the frames and audio samples that precede it, so this is the slowest
+     * mode.
+     */
+    public static final int SEEK_CLOSEST = 0x03;
+
+    /**
+     * Moves the media to specified time position by considering the given mode.
+     * The seek completes asynchronously, see {@link OnSeekCompleteListener}.
+     *
+     * @param msec the offset in milliseconds from the start to seek to
+     * @param mode one of {@link #SEEK_PREVIOUS_SYNC}, {@link #SEEK_NEXT_SYNC},
+     * {@link #SEEK_CLOSEST_SYNC} or {@link #SEEK_CLOSEST}
+     * @throws IllegalStateException if the internal player engine has not been
+     * initialized
+     * @throws IllegalArgumentException if the mode is invalid
+     */
+    public void seekTo(long msec, int mode) throws IllegalStateException {
+        if (mode < SEEK_PREVIOUS_SYNC || mode > SEEK_CLOSEST) {
+            throw new IllegalArgumentException("Illegal seek mode: " + mode);
+        }
+        if (msec > Integer.MAX_VALUE) {
+            msec = Integer.MAX_VALUE;
+        } else if (msec < Integer.MIN_VALUE) {
+            msec = Integer.MIN_VALUE;
+        }
+        _seekTo((int) msec, mode);
+    }
+
+    private native void _seekTo(int msec, int mode) throws IllegalStateException;
+
     /**
      * Gets the current playback position.
      *
@@ -1212,6 +1262,11 @@ public class FFmpegMediaPlayer
      * next player should be started at the end of playback.
      * If the current player is looping, it will keep looping and the next
      * player will not be started.
+     * A next player with the same audio sample rate and channel count takes
+     * over the audio output of this one without a gap; it reports
+     * {@link #MEDIA_INFO_STARTED_AS_NEXT} once it plays.
+     * A player is the next player of one player at a time. Resetting,
+     * releasing or setting a new data source on either player unlinks them.
      *
      * @param next the player to start after this one completes playback.
      *
@@ -1239,6 +1294,7 @@ public class FFmpegMediaPlayer
         mOnSeekCompleteListener = null;
         mOnErrorListener = null;
         mOnInfoListener = null;
+        mOnRenderListener = null;
         mOnVideoSizeChangedListener = null;
         mOnTimedTextListener = null;
         _release();
@@ -1370,9 +1426,416 @@ public class FFmpegMediaPlayer
      */
     private static final int KEY_PARAMETER_TIMED_TEXT_ADD_OUT_OF_BAND_SOURCE = 1001;
 
-    // There are currently no defined keys usable from Java with get*Parameter.
-    // But if any keys are defined, the order must be kept in sync with include/media/mediaplayer.h.
-    // private static final int KEY_PARAMETER_... = ...;
+    /* Keys handled by the native player, keep these in sync with
+     * media_parameter_keys in ffmpeg_mediaplayer.h.
+     */
+    /**
+     * Key used in getIntParameter method.
+     * Number of times the packet queue storage was allocated. The storage is
+     * kept across seeks and reset(), so this stays flat during playback.
+     */
+    public static final int KEY_PARAMETER_PACKET_POOL_ALLOCS = 2000;
+    /**
+     * Key used in getIntParameter method.
+     * Number of demuxed packets handed to the decoders without a copy.
+     */
+    public static final int KEY_PARAMETER_PACKET_MOVES = 2001;
+    /**
+     * Key used in getIntParameter method.
+     * Number of demuxed packets that had to be copied, one allocation each.
+     */
+    public static final int KEY_PARAMETER_PACKET_COPIES = 2002;
+    /**
+     * Key used in getIntParameter method.
+     * Media time in milliseconds queued for the audio decoder.
+     */
+    public static final int KEY_PARAMETER_AUDIO_BUFFERED_MS = 2003;
+    /**
+     * Key used in getIntParameter method.
+     * Media time in milliseconds queued for the video decoder.
+     */
+    public static final int KEY_PARAMETER_VIDEO_BUFFERED_MS = 2004;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the source was connected
+     * and its first response read, or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_IO_OPEN_MS = 2005;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the container header was
+     * parsed, or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_INPUT_OPEN_MS = 2006;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the stream parameters were
+     * known, or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_STREAM_INFO_MS = 2007;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the first packet was read,
+     * or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_FIRST_PACKET_MS = 2008;
+    /**
+     * Key used in getIntParameter method.
+     * 1 if the last prepare took the stream parameters from the probe cache
+     * instead of analyzing the source, 0 otherwise.
+     */
+    public static final int KEY_PARAMETER_PROBE_CACHE_HIT = 2009;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the first audio or video
+     * frame was decoded, or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_FIRST_FRAME_MS = 2010;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the start of prepare until the player was prepared,
+     * or -1 if not reached yet.
+     */
+    public static final int KEY_PARAMETER_PREPARED_MS = 2011;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from the last seekTo until the first audio samples, or
+     * the first picture of a source without audio, at the new position were
+     * output. Compare the seek modes of {@link #seekTo(long, int)} with it.
+     */
+    public static final int KEY_PARAMETER_SEEK_MS = 2012;
+    /**
+     * Key used in getIntParameter method.
+     * Number of seeks the player ran. A seekTo replaces a seek that has not
+     * completed yet, so dragging a seek bar runs far fewer seeks than it
+     * makes calls, and only the last call reports
+     * {@link OnSeekCompleteListener#onSeekComplete}.
+     */
+    public static final int KEY_PARAMETER_SEEKS = 2013;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of audio decoded ahead of the output. Audio is decoded on
+     * its own thread, so the output keeps playing through a slow frame as
+     * long as this does not run out.
+     */
+    public static final int KEY_PARAMETER_AUDIO_DECODED_MS = 2014;
+    /**
+     * Key used in getIntParameter method.
+     * Number of audio output buffers that were filled with silence because
+     * the decoder fell behind, since the source was prepared.
+     */
+    public static final int KEY_PARAMETER_AUDIO_UNDERRUNS = 2015;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of audio the audio sink has played since the source was
+     * prepared, as reported by the sink.
+     */
+    public static final int KEY_PARAMETER_AUDIO_PLAYED_MS = 2016;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds from start to the end of an offline render, see
+     * {@link #KEY_PARAMETER_OFFLINE_RENDER}; still counting while it runs.
+     */
+    public static final int KEY_PARAMETER_RENDER_MS = 2017;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds spent demuxing in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_DEMUX_MS = 2018;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of CPU time spent demuxing in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_DEMUX_CPU_MS = 2019;
+    /**
+     * Key used in getIntParameter method.
+     * Packets per second of the time spent demuxing in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_DEMUX_FPS = 2020;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds spent decoding and resampling audio in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_AUDIO_DECODE_MS = 2021;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of CPU time spent decoding and resampling audio in an
+     * offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_AUDIO_DECODE_CPU_MS = 2022;
+    /**
+     * Key used in getIntParameter method.
+     * Audio frames per second of the time spent decoding and resampling
+     * audio in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_AUDIO_DECODE_FPS = 2023;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds spent decoding video in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_DECODE_MS = 2024;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of CPU time spent decoding video in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_DECODE_CPU_MS = 2025;
+    /**
+     * Key used in getIntParameter method.
+     * Pictures per second of the time spent decoding video in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_DECODE_FPS = 2026;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds spent converting pictures to RGBA in an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_CONVERT_MS = 2027;
+    /**
+     * Key used in getIntParameter method.
+     * Milliseconds of CPU time spent converting pictures to RGBA in an
+     * offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_CONVERT_CPU_MS = 2028;
+    /**
+     * Key used in getIntParameter method.
+     * Pictures per second of the time spent converting pictures to RGBA in
+     * an offline render.
+     */
+    public static final int KEY_PARAMETER_RENDER_VIDEO_CONVERT_FPS = 2029;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Once a stream has less than this many milliseconds queued the player
+     * resumes reading from the source. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_BUFFER_MIN_MS = 2100;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * The player stops reading from the source once every stream has this
+     * many milliseconds queued. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_BUFFER_MAX_MS = 2101;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Upper bound in bytes for the queued packets of all streams, whatever
+     * their duration. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_BUFFER_MAX_BYTES = 2102;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Playback pauses with {@link #MEDIA_INFO_BUFFERING_START} once less than
+     * this many milliseconds are queued, 0 waits until the queue runs dry.
+     * Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_BUFFERING_LOW_MS = 2103;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Playback resumes with {@link #MEDIA_INFO_BUFFERING_END} once this many
+     * milliseconds are queued again. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_BUFFERING_HIGH_MS = 2104;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * 1 memory maps local files and file descriptors, 0 (the default) reads
+     * them with pread. A mapped file that is truncated while it plays, or
+     * whose storage is removed, crashes the process with SIGBUS, so only
+     * enable it for files that stay in place, e.g. in the app's own storage.
+     * Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_MMAP_IO = 2105;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * 1 probes the source with {@link #KEY_PARAMETER_PROBE_SIZE} and
+     * {@link #KEY_PARAMETER_ANALYZE_DURATION_MS} and starts from the container
+     * header alone when it describes every stream, which shortens the time to
+     * {@link OnPreparedListener#onPrepared}. 0 (the default) analyzes the
+     * streams fully. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_FAST_START = 2106;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Number of bytes probed to detect the format in fast start mode.
+     * Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PROBE_SIZE = 2107;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Milliseconds of media analyzed for stream parameters in fast start
+     * mode. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_ANALYZE_DURATION_MS = 2108;
+    /**
+     * Key used in setParameter(int, String) method.
+     * Directory in which the results of analyzing a source are kept, so
+     * preparing the same file or URL again only reads its header, e.g. a
+     * directory under {@link android.content.Context#getCacheDir}. Sources
+     * are identified by file identity, size and modification time, or by URL
+     * and size. Disabled (the default) when empty. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PROBE_CACHE_DIR = 2109;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Size limit in bytes of the probe cache directory; the least recently
+     * used entries are deleted above it. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PROBE_CACHE_MAX_BYTES = 2110;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Milliseconds of audio that must be read before the player is
+     * prepared. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PREPARED_AUDIO_MS = 2111;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * 1 (the default) waits for the first decoded picture of a video stream
+     * before the player is prepared, 0 does not. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PREPARED_VIDEO_FRAME = 2112;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Milliseconds {@link #prepare()} waits for the source before it fails;
+     * the player then keeps preparing and reports the result to
+     * {@link OnPreparedListener} or {@link OnErrorListener}. 0 (the default)
+     * waits until the source is prepared. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_PREPARE_TIMEOUT_MS = 2113;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * 1 (the default) records the keyframes read during playback and seeks
+     * straight to them in formats without an index of their own, such as
+     * MPEG-TS, ADTS and MP3; 0 leaves seeking to the demuxer. With a
+     * {@link #KEY_PARAMETER_PROBE_CACHE_DIR} the keyframes are kept there
+     * for the next time the source is played. Set after setDataSource.
+     */
+    public static final int KEY_PARAMETER_SEEK_INDEX = 2114;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Set to 1 while the user drags a seek bar: each {@link #seekTo(int)}
+     * then shows the keyframe closest to its target as soon as it is
+     * decoded, even when paused, and the audio is neither read nor decoded.
+     * Set back to 0 on release; playback resumes at the last target with
+     * audio, without another {@link OnSeekCompleteListener} call. Can be
+     * set at any time and has no effect on sources without video.
+     */
+    public static final int KEY_PARAMETER_SCRUB = 2115;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Preset of the audio output buffers, {@link #AUDIO_BUFFERS_LOW_POWER}
+     * (the default) or {@link #AUDIO_BUFFERS_LOW_LATENCY}; reads back -1 if
+     * the count or length was set to something else. Set before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_BUFFERS = 2116;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Number of buffers kept enqueued on the audio output, 2 to 16. Set
+     * before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_BUFFER_COUNT = 2117;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Milliseconds of audio in each audio output buffer, 1 to 200. Set
+     * before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_BUFFER_MS = 2118;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Where the decoded audio goes, {@link #AUDIO_SINK_OPENSL} (the default),
+     * {@link #AUDIO_SINK_NULL}, {@link #AUDIO_SINK_NULL_UNTHROTTLED},
+     * {@link #AUDIO_SINK_WAV} or {@link #AUDIO_SINK_WAV_UNTHROTTLED}. Set
+     * before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_SINK = 2119;
+    /**
+     * Key used in setParameter(int, String) method.
+     * File the WAV audio sinks write to. Set before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_SINK_PATH = 2120;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * 1 renders the source as fast as it can be decoded instead of playing
+     * it: pictures are converted but not shown, the audio goes to an
+     * unthrottled null or WAV sink, and the time spent in each stage can be
+     * read with the KEY_PARAMETER_RENDER_* keys. The pictures and samples
+     * are delivered to the {@link OnRenderListener}, if one is set.
+     * Set before prepare.
+     */
+    public static final int KEY_PARAMETER_OFFLINE_RENDER = 2121;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Sample rate in Hz the audio is resampled to before it reaches the
+     * audio sink, e.g. the native rate of the device output so the system
+     * mixer does not resample it a second time. 0 (the default) keeps the
+     * rate of the source. Set before prepare, see
+     * {@link #setAudioOutputFormatToDevice}.
+     */
+    public static final int KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE = 2122;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Channels of the audio output, 1 or 2. 0 (the default) keeps those of
+     * the source and downmixes sources with more channels to stereo. Set
+     * before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_OUTPUT_CHANNELS = 2123;
+    /**
+     * Key used in setParameter and getIntParameter methods.
+     * Quality of the audio resampler, {@link #RESAMPLER_QUALITY_FAST},
+     * {@link #RESAMPLER_QUALITY_DEFAULT} (the default) or
+     * {@link #RESAMPLER_QUALITY_HIGH}. Set before prepare.
+     */
+    public static final int KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY = 2124;
+
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_BUFFERS}: 4 buffers of 20 ms, the
+     * output wakes the player less often.
+     */
+    public static final int AUDIO_BUFFERS_LOW_POWER = 0;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_BUFFERS}: 2 buffers of 5 ms, less
+     * audio between the decoder and the speaker.
+     */
+    public static final int AUDIO_BUFFERS_LOW_LATENCY = 1;
+
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_SINK}: the device, through an
+     * OpenSL ES buffer queue.
+     */
+    public static final int AUDIO_SINK_OPENSL = 0;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_SINK}: the samples are dropped at
+     * the rate they would play.
+     */
+    public static final int AUDIO_SINK_NULL = 1;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_SINK}: the samples are dropped as
+     * fast as they are decoded, to measure the decoder.
+     */
+    public static final int AUDIO_SINK_NULL_UNTHROTTLED = 2;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_SINK}: the samples are written to
+     * the WAV file {@link #KEY_PARAMETER_AUDIO_SINK_PATH} at the rate they
+     * would play.
+     */
+    public static final int AUDIO_SINK_WAV = 3;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_SINK}: the samples are written to
+     * the WAV file {@link #KEY_PARAMETER_AUDIO_SINK_PATH} as fast as they are
+     * decoded.
+     */
+    public static final int AUDIO_SINK_WAV_UNTHROTTLED = 4;
+
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY}: a short
+     * filter, the least CPU time.
+     */
+    public static final int RESAMPLER_QUALITY_FAST = 0;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY}: the
+     * swresample defaults.
+     */
+    public static final int RESAMPLER_QUALITY_DEFAULT = 1;
+    /**
+     * Value of {@link #KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY}: a longer
+     * filter with a higher cutoff, for music.
+     */
+    public static final int RESAMPLER_QUALITY_HIGH = 2;
 
     /**
      * Sets the parameter indicated by key.
@@ -1391,13 +1854,11 @@ public class FFmpegMediaPlayer
      * {@hide}
      */
     public boolean setParameter(int key, String value) {
-        Parcel p = Parcel.obtain();
-        p.writeString(value);
-        boolean ret = setParameter(key, p);
-        p.recycle();
-        return ret;
+        return _setStringParameter(key, value);
     }
 
+    private native boolean _setStringParameter(int key, String value);
+
     /**
      * Sets the parameter indicated by key.
      * @param key key indicates the parameter to be set.
@@ -1406,11 +1867,34 @@ public class FFmpegMediaPlayer
      * {@hide}
      */
     public boolean setParameter(int key, int value) {
-        Parcel p = Parcel.obtain();
-        p.writeInt(value);
-        boolean ret = setParameter(key, p);
-        p.recycle();
-        return ret;
+        return _setParameter(key, value);
+    }
+
+    private native boolean _setParameter(int key, int value);
+
+    /**
+     * Resamples the audio to the native sample rate of the device output
+     * in stereo, so it is converted once by the player and can take the
+     * low latency path of the system mixer. Call before prepare.
+     * @param context used to look up the output sample rate.
+     * @return true if the device reported its rate and it was set
+     */
+    public boolean setAudioOutputFormatToDevice(Context context) {
+        AudioManager audioManager = (AudioManager) context.getSystemService(Context.AUDIO_SERVICE);
+        String rate = audioManager != null ?
+                audioManager.getProperty(AudioManager.PROPERTY_OUTPUT_SAMPLE_RATE) : null;
+
+        if (rate == null) {
+            return false;
+        }
+
+        try {
+            return setParameter(KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE, Integer.parseInt(rate)) &&
+                    setParameter(KEY_PARAMETER_AUDIO_OUTPUT_CHANNELS, 2);
+        } catch (NumberFormatException e) {
+            Log.w(TAG, "Unexpected output sample rate " + rate);
+            return false;
+        }
     }
 
     /**
@@ -1454,13 +1938,11 @@ public class FFmpegMediaPlayer
      * {@hide}
      */
     public int getIntParameter(int key) {
-        Parcel p = Parcel.obtain();
-        getParameter(key, p);
-        int ret = p.readInt();
-        p.recycle();
-        return ret;
+        return _getIntParameter(key);
     }
 
+    private native int _getIntParameter(int key);
+
     /**
      * Sets the send level of the player to the attached auxiliary effect
      * {@see #attachAuxEffect(int)}. The level value range is 0 to 1.0.
@@ -1657,6 +2139,41 @@ public class FFmpegMediaPlayer
         }
     }
 
+    /**
+     * Called from native code on a render thread with the samples an offline
+     * render pulled from the audio output.
+     */
+    private static void postRenderAudioFromNative(Object mediaplayer_ref, ByteBuffer pcm)
+    {
+        FFmpegMediaPlayer mp = (FFmpegMediaPlayer)((WeakReference)mediaplayer_ref).get();
+        if (mp == null) {
+            return;
+        }
+
+        OnRenderListener listener = mp.mOnRenderListener;
+        if (listener != null) {
+            listener.onRenderAudio(mp, pcm);
+        }
+    }
+
+    /**
+     * Called from native code on a render thread with each picture an
+     * offline render converted.
+     */
+    private static void postRenderVideoFromNative(Object mediaplayer_ref, ByteBuffer rgba,
+                                                  int width, int height, int stride, long ptsUs)
+    {
+        FFmpegMediaPlayer mp = (FFmpegMediaPlayer)((WeakReference)mediaplayer_ref).get();
+        if (mp == null) {
+            return;
+        }
+
+        OnRenderListener listener = mp.mOnRenderListener;
+        if (listener != null) {
+            listener.onRenderVideo(mp, rgba, width, height, stride, ptsUs);
+        }
+    }
+
     /**
      * Called from native code when an interesting event happens.  This method
      * just uses the EventHandler system to post the event back to the main app thread.
@@ -1923,6 +2440,12 @@ public class FFmpegMediaPlayer
      */
     public static final int MEDIA_INFO_UNKNOWN = 1;
 
+    /** The player was started because the player it was set as next player
+     * of through {@link #setNextMediaPlayer(FFmpegMediaPlayer)} completed.
+     * @see android.media.MediaPlayer.OnInfoListener
+     */
+    public static final int MEDIA_INFO_STARTED_AS_NEXT = 2;
+
     /** The video is too complex for the decoder: it can't decode frames fast
      *  enough. Possibly only the audio plays fine at this stage.
      * @see android.media.MediaPlayer.OnInfoListener
@@ -1970,6 +2493,7 @@ public class FFmpegMediaPlayer
          * @param what    the type of info or warning.
          * <ul>
          * <li>{@link #MEDIA_INFO_UNKNOWN}
+         * <li>{@link #MEDIA_INFO_STARTED_AS_NEXT}
          * <li>{@link #MEDIA_INFO_VIDEO_TRACK_LAGGING}
          * <li>{@link #MEDIA_INFO_BUFFERING_START}
          * <li>{@link #MEDIA_INFO_BUFFERING_END}
@@ -1997,6 +2521,54 @@ public class FFmpegMediaPlayer
     }
 
     private OnInfoListener mOnInfoListener;
+
+    /**
+     * Interface definition of callbacks that receive the output of an
+     * offline render, see {@link #KEY_PARAMETER_OFFLINE_RENDER}. They are
+     * called on the render threads, not on the application thread, and the
+     * buffers wrap native memory that is only valid until the call returns.
+     */
+    public interface OnRenderListener
+    {
+        /**
+         * Called with each block of samples pulled from the audio output:
+         * interleaved 16 bit samples in native byte order, at the output
+         * sample rate and channel count.
+         *
+         * @param mp the MediaPlayer that rendered the samples
+         * @param pcm the samples, from position 0 to the limit
+         */
+        void onRenderAudio(FFmpegMediaPlayer mp, ByteBuffer pcm);
+
+        /**
+         * Called with each converted picture, in presentation order.
+         *
+         * @param mp the MediaPlayer that rendered the picture
+         * @param rgba the RGBA pixels, height rows of stride bytes
+         * @param width the width of the picture in pixels
+         * @param height the height of the picture in pixels
+         * @param stride the size of a row in bytes
+         * @param ptsUs the presentation time of the picture in microseconds
+         */
+        void onRenderVideo(FFmpegMediaPlayer mp, ByteBuffer rgba, int width, int height,
+                           int stride, long ptsUs);
+    }
+
+    /**
+     * Register callbacks to be invoked with the pictures and samples of an
+     * offline render.
+     *
+     * @param listener the callbacks that will be run, null to drop the output
+     */
+    public void setOnRenderListener(OnRenderListener listener)
+    {
+        mOnRenderListener = listener;
+        _setRenderListener(listener != null);
+    }
+
+    private native void _setRenderListener(boolean enable);
+
+    private volatile OnRenderListener mOnRenderListener;
     
     private int attachAuxEffectCompat(int effectId) {
     	int ret = -3;
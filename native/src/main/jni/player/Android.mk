@@ -12,7 +12,14 @@ LOCAL_SRC_FILES := $(SDL_PATH)/src/main/android/SDL_android_main.c \
 	ffmpeg_mediaplayer.c \
 	audioplayer.c \
 	videoplayer.c \
-	ffmpeg_utils.c
+	ffmpeg_utils.c \
+	packet_queue.c \
+	fd_io.c \
+	probe_cache.c \
+	seek_index.c \
+	pcm_ring.c \
+	audio_sink.c \
+	render_stats.c
 LOCAL_SHARED_LIBRARIES := SDL2 libswresample libswscale libavcodec libavformat libavutil
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)/../ffmpeg/ffmpeg/$(TARGET_ARCH_ABI)/include
 # for native audio
@@ -23,3 +30,7 @@ LOCAL_LDLIBS += -landroid
 LOCAL_LDLIBS += -ljnigraphics
 
 include $(BUILD_SHARED_LIBRARY)
+
+ifeq ($(FFMPEG_MEDIAPLAYER_BENCH),1)
+include $(LOCAL_PATH)/bench/Android.mk
+endif
@@ -0,0 +1,355 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/intreadwrite.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <ffmpeg_mediaplayer.h>
+#include <audio_sink.h>
+
+#define WAV_HEADER_SIZE 44
+/* poll interval of a sink whose player played to the end (us) */
+#define THREAD_SINK_IDLE_US 10000
+
+/*
+ * The null and WAV sinks: a thread pulls buffer_ms of samples at a time
+ * while the sink is started, either paced by the wall clock like a device
+ * or as fast as the player delivers them.
+ */
+typedef struct ThreadSink {
+  pthread_t tid;
+  int thread_started;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;   /* signalled on start and close */
+  int running;
+  int quit;
+  int realtime;
+  FILE *file;            /* NULL for the null sink */
+  int64_t data_size;     /* bytes of samples written to file */
+  uint8_t *buffer;
+  int buffer_size;
+  int64_t frames;        /* frames pulled since open */
+} ThreadSink;
+
+static void wav_write_header(ThreadSink *ts, AudioSink *sink) {
+  uint8_t header[WAV_HEADER_SIZE];
+  int64_t data_size = FFMIN(ts->data_size, UINT32_MAX - WAV_HEADER_SIZE);
+
+  memcpy(header, "RIFF", 4);
+  AV_WL32(header + 4, (uint32_t) (data_size + WAV_HEADER_SIZE - 8));
+  memcpy(header + 8, "WAVEfmt ", 8);
+  AV_WL32(header + 16, 16);
+  AV_WL16(header + 20, 1);  /* PCM */
+  AV_WL16(header + 22, sink->channels);
+  AV_WL32(header + 24, sink->sample_rate);
+  AV_WL32(header + 28, sink->sample_rate * sink->channels * 2);
+  AV_WL16(header + 32, sink->channels * 2);
+  AV_WL16(header + 34, 16);
+  memcpy(header + 36, "data", 4);
+  AV_WL32(header + 40, (uint32_t) data_size);
+
+  fseek(ts->file, 0, SEEK_SET);
+  fwrite(header, 1, WAV_HEADER_SIZE, ts->file);
+  fseek(ts->file, 0, SEEK_END);
+}
+
+static void *thread_sink_run(void *arg) {
+  AudioSink *sink = (AudioSink *) arg;
+  ThreadSink *ts = (ThreadSink *) sink->priv;
+  int64_t clock_start = 0, clock_frames = 0, delay;
+  int frame_size = sink->channels * 2;
+
+  for (;;) {
+    pthread_mutex_lock(&ts->mutex);
+    if (!ts->running) {
+      /* the clock restarts on the next start */
+      clock_start = 0;
+    }
+    while (!ts->quit && !ts->running) {
+      pthread_cond_wait(&ts->cond, &ts->mutex);
+    }
+    pthread_mutex_unlock(&ts->mutex);
+    if (ts->quit) {
+      break;
+    }
+
+    /* parked until a seek restarts the output or the sink is closed */
+    if (audio_output_done(sink->state)) {
+      clock_start = 0;
+      av_usleep(THREAD_SINK_IDLE_US);
+      continue;
+    }
+
+    if (!clock_start) {
+      clock_start = av_gettime();
+      clock_frames = ts->frames;
+    }
+
+    if (!ts->realtime && !audio_samples_ready(sink->state, ts->buffer_size)) {
+      av_usleep(1000);
+      continue;
+    }
+
+    audio_sink_pull(sink, ts->buffer, ts->buffer_size);
+    if (ts->file && fwrite(ts->buffer, 1, ts->buffer_size, ts->file) == (size_t) ts->buffer_size) {
+      ts->data_size += ts->buffer_size;
+    }
+    ts->frames += ts->buffer_size / frame_size;
+
+    if (ts->realtime) {
+      delay = clock_start + (ts->frames - clock_frames) * 1000000 / sink->sample_rate - av_gettime();
+      if (delay > 0) {
+        av_usleep((unsigned int) delay);
+      }
+    }
+  }
+  return NULL;
+}
+
+static int thread_sink_open(AudioSink *sink, int realtime, const char *path) {
+  ThreadSink *ts;
+
+  if (sink->channels <= 0 || sink->sample_rate <= 0) {
+    return -1;
+  }
+
+  ts = av_mallocz(sizeof(ThreadSink));
+  if (!ts) {
+    return -1;
+  }
+  sink->priv = ts;
+  ts->realtime = realtime;
+  ts->buffer_size = (int) ((int64_t) sink->sample_rate * sink->buffer_ms / 1000) * sink->channels * 2;
+  if (ts->buffer_size <= 0) {
+    ts->buffer_size = 4096;
+  }
+  ts->buffer = av_malloc(ts->buffer_size);
+  if (!ts->buffer) {
+    return -1;
+  }
+
+  if (path) {
+    ts->file = fopen(path, "wb");
+    if (!ts->file) {
+      fprintf(stderr, "%s: could not open the WAV file\n", path);
+      return -1;
+    }
+    /* completed with the sizes on close */
+    wav_write_header(ts, sink);
+  }
+
+  pthread_mutex_init(&ts->mutex, NULL);
+  pthread_cond_init(&ts->cond, NULL);
+  if (pthread_create(&ts->tid, NULL, thread_sink_run, sink) != 0) {
+    return -1;
+  }
+  ts->thread_started = 1;
+  return 0;
+}
+
+static int null_sink_open(AudioSink *sink) {
+  return thread_sink_open(sink, 1, NULL);
+}
+
+static int null_unthrottled_sink_open(AudioSink *sink) {
+  return thread_sink_open(sink, 0, NULL);
+}
+
+static int wav_sink_open(AudioSink *sink) {
+  return thread_sink_open(sink, 1, sink->path);
+}
+
+static int wav_unthrottled_sink_open(AudioSink *sink) {
+  return thread_sink_open(sink, 0, sink->path);
+}
+
+static void thread_sink_set_running(AudioSink *sink, int running) {
+  ThreadSink *ts = (ThreadSink *) sink->priv;
+
+  pthread_mutex_lock(&ts->mutex);
+  ts->running = running;
+  pthread_cond_signal(&ts->cond);
+  pthread_mutex_unlock(&ts->mutex);
+}
+
+static void thread_sink_start(AudioSink *sink) {
+  thread_sink_set_running(sink, 1);
+}
+
+static void thread_sink_pause(AudioSink *sink) {
+  thread_sink_set_running(sink, 0);
+}
+
+static int64_t thread_sink_position(AudioSink *sink) {
+  ThreadSink *ts = (ThreadSink *) sink->priv;
+
+  return ts->frames * 1000 / sink->sample_rate;
+}
+
+static void thread_sink_close(AudioSink *sink) {
+  ThreadSink *ts = (ThreadSink *) sink->priv;
+
+  if (!ts) {
+    return;
+  }
+
+  if (ts->thread_started) {
+    pthread_mutex_lock(&ts->mutex);
+    ts->quit = 1;
+    pthread_cond_signal(&ts->cond);
+    pthread_mutex_unlock(&ts->mutex);
+    pthread_join(ts->tid, NULL);
+    pthread_cond_destroy(&ts->cond);
+    pthread_mutex_destroy(&ts->mutex);
+  }
+
+  if (ts->file) {
+    wav_write_header(ts, sink);
+    fclose(ts->file);
+  }
+  av_freep(&ts->buffer);
+  av_freep(&sink->priv);
+}
+
+static const AudioSinkOps null_audio_sink_ops = {
+  .name = "null",
+  .open = null_sink_open,
+  .start = thread_sink_start,
+  .pause = thread_sink_pause,
+  .stop = thread_sink_pause,
+  .position = thread_sink_position,
+  .close = thread_sink_close,
+};
+
+static const AudioSinkOps null_unthrottled_audio_sink_ops = {
+  .name = "null-unthrottled",
+  .open = null_unthrottled_sink_open,
+  .start = thread_sink_start,
+  .pause = thread_sink_pause,
+  .stop = thread_sink_pause,
+  .position = thread_sink_position,
+  .close = thread_sink_close,
+};
+
+static const AudioSinkOps wav_audio_sink_ops = {
+  .name = "wav",
+  .open = wav_sink_open,
+  .start = thread_sink_start,
+  .pause = thread_sink_pause,
+  .stop = thread_sink_pause,
+  .position = thread_sink_position,
+  .close = thread_sink_close,
+};
+
+static const AudioSinkOps wav_unthrottled_audio_sink_ops = {
+  .name = "wav-unthrottled",
+  .open = wav_unthrottled_sink_open,
+  .start = thread_sink_start,
+  .pause = thread_sink_pause,
+  .stop = thread_sink_pause,
+  .position = thread_sink_position,
+  .close = thread_sink_close,
+};
+
+AudioSink *audio_sink_alloc(int type) {
+  AudioSink *sink;
+  const AudioSinkOps *ops;
+
+  switch (type) {
+  case AUDIO_SINK_OPENSL:
+    ops = &opensl_audio_sink_ops;
+    break;
+  case AUDIO_SINK_NULL:
+    ops = &null_audio_sink_ops;
+    break;
+  case AUDIO_SINK_NULL_UNTHROTTLED:
+    ops = &null_unthrottled_audio_sink_ops;
+    break;
+  case AUDIO_SINK_WAV:
+    ops = &wav_audio_sink_ops;
+    break;
+  case AUDIO_SINK_WAV_UNTHROTTLED:
+    ops = &wav_unthrottled_audio_sink_ops;
+    break;
+  default:
+    return NULL;
+  }
+
+  sink = av_mallocz(sizeof(AudioSink));
+  if (sink) {
+    sink->ops = ops;
+  }
+  return sink;
+}
+
+int audio_sink_open(AudioSink *sink) {
+  return sink->ops->open(sink);
+}
+
+void audio_sink_start(AudioSink *sink) {
+  if (sink->ops->start) {
+    sink->ops->start(sink);
+  }
+}
+
+void audio_sink_pause(AudioSink *sink) {
+  if (sink->ops->pause) {
+    sink->ops->pause(sink);
+  }
+}
+
+void audio_sink_stop(AudioSink *sink) {
+  if (sink->ops->stop) {
+    sink->ops->stop(sink);
+  }
+}
+
+void audio_sink_set_volume(AudioSink *sink, float volume) {
+  if (sink->ops->set_volume) {
+    sink->ops->set_volume(sink, volume);
+  }
+}
+
+int audio_sink_latency(AudioSink *sink) {
+  return sink->ops->latency ? sink->ops->latency(sink) : 0;
+}
+
+int64_t audio_sink_position(AudioSink *sink) {
+  return sink->ops->position ? sink->ops->position(sink) : 0;
+}
+
+void audio_sink_pull(AudioSink *sink, uint8_t *stream, int len) {
+  VideoState *is = sink->state;
+
+  is->audio_callback(is, stream, len);
+}
+
+/* Closes the sink, also after a failed open */
+void audio_sink_free(AudioSink **sink) {
+  if (!*sink) {
+    return;
+  }
+
+  (*sink)->ops->close(*sink);
+  av_freep(sink);
+}
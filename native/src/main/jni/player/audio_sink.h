@@ -0,0 +1,87 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_SINK_H_
+#define AUDIO_SINK_H_
+
+#include <stdint.h>
+
+struct VideoState;
+struct AudioSink;
+
+/* values of KEY_PARAMETER_AUDIO_SINK */
+enum audio_sink_type {
+  AUDIO_SINK_OPENSL = 0,            // the device, through an OpenSL ES buffer queue
+  AUDIO_SINK_NULL = 1,              // drops the samples at the rate they would play
+  AUDIO_SINK_NULL_UNTHROTTLED = 2,  // drops the samples as fast as they are decoded
+  AUDIO_SINK_WAV = 3,               // writes a WAV file at the rate the samples would play
+  AUDIO_SINK_WAV_UNTHROTTLED = 4,   // writes a WAV file as fast as the samples are decoded
+};
+
+/*
+ * An audio output. The sink pulls interleaved S16 samples from the player
+ * with audio_sink_pull whenever it needs more, from a thread of its own.
+ * Any op but open and close may be NULL.
+ */
+typedef struct AudioSinkOps {
+  const char *name;
+  /* returns -1 if the output cannot be opened */
+  int (*open)(struct AudioSink *sink);
+  /* the first start fills the output before it starts playing */
+  void (*start)(struct AudioSink *sink);
+  void (*pause)(struct AudioSink *sink);
+  void (*stop)(struct AudioSink *sink);
+  void (*set_volume)(struct AudioSink *sink, float volume);
+  /* ms of audio pulled but not played yet */
+  int (*latency)(struct AudioSink *sink);
+  /* ms of audio played since the sink was opened */
+  int64_t (*position)(struct AudioSink *sink);
+  void (*close)(struct AudioSink *sink);
+} AudioSinkOps;
+
+typedef struct AudioSink {
+  const AudioSinkOps *ops;
+  void *priv;
+
+  /* the player whose samples are pulled, changes on a gapless switch */
+  struct VideoState *state;
+  int channels;
+  int sample_rate;
+
+  /* configuration, read by open */
+  int stream_type;     /* Android stream type of the OpenSL player */
+  int buffer_count;    /* buffers the output keeps filled */
+  int buffer_ms;
+  char path[1024];     /* file written by the WAV sinks */
+} AudioSink;
+
+extern const AudioSinkOps opensl_audio_sink_ops;
+
+AudioSink *audio_sink_alloc(int type);
+int audio_sink_open(AudioSink *sink);
+void audio_sink_start(AudioSink *sink);
+void audio_sink_pause(AudioSink *sink);
+void audio_sink_stop(AudioSink *sink);
+void audio_sink_set_volume(AudioSink *sink, float volume);
+int audio_sink_latency(AudioSink *sink);
+int64_t audio_sink_position(AudioSink *sink);
+/* Called by the sink, fills stream with len bytes from the player */
+void audio_sink_pull(AudioSink *sink, uint8_t *stream, int len);
+void audio_sink_free(AudioSink **sink);
+
+#endif /* AUDIO_SINK_H_ */
@@ -28,65 +28,128 @@
 // this callback handler is called every time a buffer finishes playing
 void bqPlayerCallback(SLAndroidSimpleBufferQueueItf bq, void *context)
 {
-    VideoState *is = (VideoState *)context;
+    AudioPlayer *player = (AudioPlayer *)context;
+    uint8_t *buffer;
 
-    AudioPlayer *player = &is->audio_player;
-
-    if (player->buffer != NULL) {
-        free(player->buffer);
-        player->buffer = NULL;
+    if (player->buffers == NULL) {
+        return;
     }
-    
-    int len = 4096;
-    player->buffer = malloc(len);
-    
-    is->audio_callback(context, player->buffer, len);
-    enqueue(&is->audio_player, (int16_t *) player->buffer, len);
+
+    // the buffer that just finished playing is the oldest one, refill it
+    buffer = player->buffers + player->bufferIndex * player->bufferSize;
+    player->bufferIndex = (player->bufferIndex + 1) % player->bufferCount;
+
+    audio_sink_pull(player->sink, buffer, player->bufferSize);
+    enqueue(&player, (int16_t *) buffer, player->bufferSize);
 }
 
-// create the engine and output mix objects
-void createEngine(AudioPlayer **ps)
-{
-    AudioPlayer *player = *ps;
+// the engine and output mix shared by every player of the process
+static pthread_mutex_t engineLock = PTHREAD_MUTEX_INITIALIZER;
+static int engineRefs = 0;
+static SLObjectItf sharedEngineObject = NULL;
+static SLEngineItf sharedEngineEngine = NULL;
+static SLObjectItf sharedOutputMixObject = NULL;
 
-    player->buffer = NULL;
-    
+// create the engine and output mix objects, called with engineLock held
+static void createSharedEngine()
+{
     SLresult result;
 
     // create engine
-    result = slCreateEngine(&player->engineObject, 0, NULL, 0, NULL, NULL);
+    result = slCreateEngine(&sharedEngineObject, 0, NULL, 0, NULL, NULL);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
     // realize the engine
-    result = (*player->engineObject)->Realize(player->engineObject, SL_BOOLEAN_FALSE);
+    result = (*sharedEngineObject)->Realize(sharedEngineObject, SL_BOOLEAN_FALSE);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
     // get the engine interface, which is needed in order to create other objects
-    result = (*player->engineObject)->GetInterface(player->engineObject, SL_IID_ENGINE, &player->engineEngine);
+    result = (*sharedEngineObject)->GetInterface(sharedEngineObject, SL_IID_ENGINE, &sharedEngineEngine);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
     // create output mix, with environmental reverb specified as a non-required interface
     const SLInterfaceID ids[1] = {SL_IID_ENVIRONMENTALREVERB};
     const SLboolean req[1] = {SL_BOOLEAN_FALSE};
-    result = (*player->engineEngine)->CreateOutputMix(player->engineEngine, &player->outputMixObject, 0, ids, req);
+    result = (*sharedEngineEngine)->CreateOutputMix(sharedEngineEngine, &sharedOutputMixObject, 0, ids, req);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
     // realize the output mix
-    result = (*player->outputMixObject)->Realize(player->outputMixObject, SL_BOOLEAN_FALSE);
+    result = (*sharedOutputMixObject)->Realize(sharedOutputMixObject, SL_BOOLEAN_FALSE);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 }
 
+// take a reference on the shared engine and output mix, creating them for the first player
+void createEngine(AudioPlayer **ps)
+{
+    AudioPlayer *player = *ps;
+
+    memset(player, 0, sizeof(AudioPlayer));
+
+    pthread_mutex_lock(&engineLock);
+    if (engineRefs == 0) {
+        createSharedEngine();
+    }
+    engineRefs++;
+    player->engineObject = sharedEngineObject;
+    player->engineEngine = sharedEngineEngine;
+    player->outputMixObject = sharedOutputMixObject;
+    pthread_mutex_unlock(&engineLock);
+}
+
+// drop the reference of a player, the last one destroys the engine and output mix
+static void releaseEngine(AudioPlayer *player)
+{
+    if (player->engineObject == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&engineLock);
+    if (--engineRefs == 0) {
+        // destroy output mix object, and invalidate all associated interfaces
+        if (sharedOutputMixObject != NULL) {
+            (*sharedOutputMixObject)->Destroy(sharedOutputMixObject);
+            sharedOutputMixObject = NULL;
+        }
+
+        // destroy engine object, and invalidate all associated interfaces
+        if (sharedEngineObject != NULL) {
+            (*sharedEngineObject)->Destroy(sharedEngineObject);
+            sharedEngineObject = NULL;
+            sharedEngineEngine = NULL;
+        }
+    }
+    pthread_mutex_unlock(&engineLock);
+
+    player->outputMixObject = NULL;
+    player->engineObject = NULL;
+    player->engineEngine = NULL;
+}
+
 
 // create buffer queue audio player
-void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels, int samplesPerSec, int streamType)
+void createBufferQueueAudioPlayer(AudioPlayer **ps, struct AudioSink *sink, int numChannels, int samplesPerSec, int streamType,
+                                  int bufferCount, int bufferMs)
 {
     AudioPlayer *player = *ps;
 
+    player->sink = sink;
+    player->numChannels = numChannels;
+    player->samplesPerSec = samplesPerSec;
+
+    // allocated once, the callback only cycles through the buffers
+    player->bufferCount = bufferCount;
+    player->bufferSize = (int) ((int64_t) samplesPerSec * bufferMs / 1000) * numChannels * 2;
+    if (player->bufferSize <= 0) {
+        player->bufferSize = 4096;
+    }
+    player->bufferIndex = 0;
+    player->buffers = malloc(player->bufferCount * player->bufferSize);
+
     SLuint32 channelMask = 0;
     
     if (numChannels == 2) {
@@ -100,7 +163,7 @@ void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels
     SLresult result;
 
     // configure audio source
-    SLDataLocator_BufferQueue loc_bufq = {SL_DATALOCATOR_BUFFERQUEUE, BUFFER_COUNT};
+    SLDataLocator_BufferQueue loc_bufq = {SL_DATALOCATOR_BUFFERQUEUE, bufferCount};
     SLDataFormat_PCM format_pcm = {SL_DATAFORMAT_PCM, numChannels, samplesPerSec * 1000,
         SL_PCMSAMPLEFORMAT_FIXED_16, SL_PCMSAMPLEFORMAT_FIXED_16,
         channelMask, SL_BYTEORDER_LITTLEENDIAN};
@@ -149,7 +212,7 @@ void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels
     (void)result;
     
     // register callback on the buffer queue
-    result = (*player->bqPlayerBufferQueue)->RegisterCallback(player->bqPlayerBufferQueue, bqPlayerCallback, state);
+    result = (*player->bqPlayerBufferQueue)->RegisterCallback(player->bqPlayerBufferQueue, bqPlayerCallback, player);
     assert(SL_RESULT_SUCCESS == result);
     (void)result;
 
@@ -229,11 +292,15 @@ void setVolumeUriAudioPlayer(AudioPlayer **ps, int millibel)
     }
 }
 
-void queueAudioSamples(AudioPlayer **ps, void *state)
+// fill and enqueue every buffer, the callback then refills each as it finishes
+void queueAudioSamples(AudioPlayer **ps)
 {
     AudioPlayer *player = *ps;
+    int i;
 
-    bqPlayerCallback(NULL, state);
+    for (i = 0; i < player->bufferCount; i++) {
+        bqPlayerCallback(player->bqPlayerBufferQueue, player);
+    }
 }
 
 int enqueue(AudioPlayer **ps, int16_t *data, int size) {
@@ -264,22 +331,108 @@ void shutdown(AudioPlayer **ps)
         player->bqPlayerVolume = NULL;
     }
 
-    // destroy output mix object, and invalidate all associated interfaces
-    if (player->outputMixObject != NULL) {
-        (*player->outputMixObject)->Destroy(player->outputMixObject);
-        player->outputMixObject = NULL;
+    // the engine and output mix are shared with the other players
+    releaseEngine(player);
+    
+    // delete the audio buffers
+    if (player->buffers != NULL) {
+        free(player->buffers);
+        player->buffers = NULL;
     }
+}
+
+// the OpenSL ES buffer queue player as an AudioSink
+static int openslSinkOpen(AudioSink *sink)
+{
+    AudioPlayer *player = malloc(sizeof(AudioPlayer));
 
-    // destroy engine object, and invalidate all associated interfaces
-    if (player->engineObject != NULL) {
-        (*player->engineObject)->Destroy(player->engineObject);
-        player->engineObject = NULL;
-        player->engineEngine = NULL;
+    if (player == NULL) {
+        return -1;
     }
-    
-    // delete the audio buffer
-    if (player->buffer != NULL) {
-        free(player->buffer);
-        player->buffer = NULL;
+    sink->priv = player;
+    createEngine(&player);
+    createBufferQueueAudioPlayer(&player, sink, sink->channels, sink->sample_rate, sink->stream_type,
+                                 sink->buffer_count, sink->buffer_ms);
+    return player->buffers != NULL ? 0 : -1;
+}
+
+static void openslSinkStart(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+
+    // the buffer queue callback keeps the output fed from here on
+    if (!player->primed) {
+        player->primed = 1;
+        queueAudioSamples(&player);
     }
+    setPlayingAudioPlayer(&player, 0);
 }
+
+static void openslSinkPause(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+
+    setPlayingAudioPlayer(&player, 1);
+}
+
+static void openslSinkStop(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+
+    setPlayingAudioPlayer(&player, 2);
+}
+
+static void openslSinkSetVolume(AudioSink *sink, float volume)
+{
+    AudioPlayer *player = sink->priv;
+
+    setVolumeUriAudioPlayer(&player, volume);
+}
+
+// the buffers still enqueued on the device
+static int openslSinkLatency(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+    SLAndroidSimpleBufferQueueState state;
+
+    if (player->bqPlayerBufferQueue == NULL ||
+        (*player->bqPlayerBufferQueue)->GetState(player->bqPlayerBufferQueue, &state) != SL_RESULT_SUCCESS) {
+        return 0;
+    }
+    return (int) ((int64_t) state.count * player->bufferSize * 1000 /
+                  (player->samplesPerSec * player->numChannels * 2));
+}
+
+static int64_t openslSinkPosition(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+    SLmillisecond position = 0;
+
+    if (player->bqPlayerPlay != NULL) {
+        (*player->bqPlayerPlay)->GetPosition(player->bqPlayerPlay, &position);
+    }
+    return position;
+}
+
+static void openslSinkClose(AudioSink *sink)
+{
+    AudioPlayer *player = sink->priv;
+
+    if (player != NULL) {
+        shutdown(&player);
+        free(player);
+        sink->priv = NULL;
+    }
+}
+
+const AudioSinkOps opensl_audio_sink_ops = {
+    .name = "opensl",
+    .open = openslSinkOpen,
+    .start = openslSinkStart,
+    .pause = openslSinkPause,
+    .stop = openslSinkStop,
+    .set_volume = openslSinkSetVolume,
+    .latency = openslSinkLatency,
+    .position = openslSinkPosition,
+    .close = openslSinkClose,
+};
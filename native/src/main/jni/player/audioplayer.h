@@ -33,19 +33,30 @@
 #include <sys/types.h>
 
 #include <ffmpeg_mediaplayer.h>
+#include <audio_sink.h>
 #include <stdint.h>
 
-static const int BUFFER_COUNT = 2;
+/*
+ * Buffers kept enqueued on the buffer queue player and the audio each one
+ * holds. Low power wakes the callback less often, low latency keeps less
+ * audio between the decoder and the speaker.
+ */
+#define AUDIO_BUFFERS_LOW_POWER_COUNT 4
+#define AUDIO_BUFFERS_LOW_POWER_MS 20
+#define AUDIO_BUFFERS_LOW_LATENCY_COUNT 2
+#define AUDIO_BUFFERS_LOW_LATENCY_MS 5
+#define AUDIO_BUFFERS_MAX_COUNT 16
+#define AUDIO_BUFFERS_MAX_MS 200
 
 static const SLEnvironmentalReverbSettings reverbSettings =
     SL_I3DL2_ENVIRONMENT_PRESET_STONECORRIDOR;
 
 typedef struct AudioPlayer {
-    // engine interfaces
+    // engine interfaces, shared by all players and reference counted
     SLObjectItf engineObject;
     SLEngineItf engineEngine;
     
-    // output mix interfaces
+    // output mix interfaces, shared like the engine
     SLObjectItf outputMixObject;
     
     // buffer queue player interfaces
@@ -58,15 +69,24 @@ typedef struct AudioPlayer {
     
 	void (*bqPlayerCallback) (SLAndroidSimpleBufferQueueItf, void *);
     
-    void (*audio_callback) (void *userdata, uint8_t *stream, int len);
-    uint8_t *buffer;
+    uint8_t *buffers;     // bufferCount buffers of bufferSize bytes, filled in turn
+    int bufferCount;
+    int bufferSize;
+    int bufferIndex;      // next buffer to fill
+
+    // the sink this player implements, samples are pulled through it
+    struct AudioSink *sink;
+    int numChannels;
+    int samplesPerSec;
+    int primed;           // the buffers were filled and enqueued by the first start
 } AudioPlayer;
 
 void createEngine(AudioPlayer **ps);
-void createBufferQueueAudioPlayer(AudioPlayer **ps, void *state, int numChannels, int samplesPerSec, int streamType);
+void createBufferQueueAudioPlayer(AudioPlayer **ps, struct AudioSink *sink, int numChannels, int samplesPerSec, int streamType,
+                                  int bufferCount, int bufferMs);
 void setPlayingAudioPlayer(AudioPlayer **ps, int playstate);
 void setVolumeUriAudioPlayer(AudioPlayer **ps, int millibel);
-void queueAudioSamples(AudioPlayer **ps, void *state);
+void queueAudioSamples(AudioPlayer **ps);
 int enqueue(AudioPlayer **ps, int16_t *data, int size);
 void shutdown(AudioPlayer **ps);
 
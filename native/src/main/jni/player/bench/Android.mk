@@ -0,0 +1,25 @@
+# Standalone benchmarks, built with ndk-build FFMPEG_MEDIAPLAYER_BENCH=1,
+# pushed to a device with adb and run from a shell there.
+LOCAL_PATH := $(call my-dir)
+PLAYER_PATH := $(LOCAL_PATH)/..
+SDL_PATH := $(PLAYER_PATH)/../SDL
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := packet_queue_bench
+LOCAL_C_INCLUDES := $(PLAYER_PATH) $(SDL_PATH)/include
+LOCAL_SRC_FILES := packet_queue_bench.c \
+	../packet_queue.c
+LOCAL_SHARED_LIBRARIES := SDL2 libavcodec libavutil
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := fd_io_bench
+LOCAL_C_INCLUDES := $(PLAYER_PATH)
+LOCAL_SRC_FILES := fd_io_bench.c \
+	../fd_io.c
+LOCAL_SHARED_LIBRARIES := libavformat libavutil
+
+include $(BUILD_EXECUTABLE)
@@ -0,0 +1,136 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Read throughput of a local file through the file: protocol and through
+ * fd_io with pread and with mmap. Each pass reads the whole file with
+ * avio_read in chunks the size a demuxer asks for. Run it once to warm
+ * the page cache, or drop the cache between passes (as root,
+ * echo 3 > /proc/sys/vm/drop_caches) to include the disk.
+ *
+ *   fd_io_bench <file> [passes] [read size]
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libavformat/avio.h>
+#include <libavutil/mem.h>
+#include <libavutil/time.h>
+
+#include <fd_io.h>
+
+#define BENCH_DEFAULT_PASSES 5
+#define BENCH_DEFAULT_READ_SIZE 4096
+
+/* Reads pb to the end, returns the bytes read or a negative error */
+static int64_t bench_read(AVIOContext *pb, uint8_t *buf, int read_size) {
+  int64_t total = 0;
+  int ret;
+
+  while ((ret = avio_read(pb, buf, read_size)) > 0) {
+    total += ret;
+  }
+  return ret == AVERROR_EOF || ret == 0 ? total : ret;
+}
+
+/* Best throughput of passes over path in MB/s, -1 on error */
+static double bench_run(const char *path, int fd_io_flags, int use_fd_io,
+                        int passes, uint8_t *buf, int read_size) {
+  double best = 0;
+  int64_t start, elapsed, bytes;
+  AVIOContext *pb;
+  int i, fd = -1;
+
+  for (i = 0; i < passes; i++) {
+    start = av_gettime_relative();
+    if (use_fd_io) {
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+      pb = fd != -1 ? fd_io_open(fd, 0, 0, fd_io_flags) : NULL;
+    } else if (avio_open2(&pb, path, AVIO_FLAG_READ, NULL, NULL) < 0) {
+      pb = NULL;
+    }
+    if (!pb) {
+      fprintf(stderr, "Unable to open %s\n", path);
+      if (fd != -1) {
+        close(fd);
+      }
+      return -1;
+    }
+
+    bytes = bench_read(pb, buf, read_size);
+
+    if (use_fd_io) {
+      fd_io_close(&pb);
+      close(fd);
+    } else {
+      avio_closep(&pb);
+    }
+    elapsed = av_gettime_relative() - start;
+
+    if (bytes < 0) {
+      fprintf(stderr, "Error reading %s\n", path);
+      return -1;
+    }
+    if (elapsed > 0 && bytes / (elapsed / 1000000.0) > best) {
+      best = bytes / (elapsed / 1000000.0);
+    }
+  }
+  return best / (1024 * 1024);
+}
+
+int main(int argc, char *argv[]) {
+  int passes, read_size;
+  double file_rate, pread_rate, mmap_rate;
+  char url[1024];
+  uint8_t *buf;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <file> [passes] [read size]\n", argv[0]);
+    return 1;
+  }
+  passes = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_PASSES;
+  read_size = argc > 3 ? atoi(argv[3]) : BENCH_DEFAULT_READ_SIZE;
+  if (passes <= 0 || read_size <= 0) {
+    fprintf(stderr, "usage: %s <file> [passes] [read size]\n", argv[0]);
+    return 1;
+  }
+
+  buf = av_malloc(read_size);
+  if (!buf) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  snprintf(url, sizeof(url), "file:%s", argv[1]);
+
+  file_rate = bench_run(url, 0, 0, passes, buf, read_size);
+  pread_rate = bench_run(argv[1], 0, 1, passes, buf, read_size);
+  mmap_rate = bench_run(argv[1], FD_IO_MMAP, 1, passes, buf, read_size);
+  av_free(buf);
+  if (file_rate < 0 || pread_rate < 0 || mmap_rate < 0) {
+    return 1;
+  }
+
+  printf("best of %d passes, reads of %d bytes\n", passes, read_size);
+  printf("file: protocol: %10.1f MB/s\n", file_rate);
+  printf("fd_io pread:    %10.1f MB/s\n", pread_rate);
+  printf("fd_io mmap:     %10.1f MB/s\n", mmap_rate);
+  return 0;
+}
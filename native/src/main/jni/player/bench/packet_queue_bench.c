@@ -0,0 +1,226 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Packets per second through the packet queue, one demux-like producer
+ * thread and one decoder-like consumer thread, for the SPSC ring in
+ * packet_queue.c and for the AVPacketList queue it replaced.
+ *
+ *   packet_queue_bench [packets] [packet size]
+ */
+
+#define SDL_MAIN_HANDLED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <ffmpeg_mediaplayer.h>
+#include <packet_queue.h>
+
+#define BENCH_DEFAULT_PACKETS 1000000
+#define BENCH_DEFAULT_PACKET_SIZE 4096
+
+/* The queue before the SPSC ring: a mutex and an av_malloc'd node per packet */
+typedef struct OldPacketQueue {
+  AVPacketList *first_pkt, *last_pkt;
+  int nb_packets;
+  int size;
+  SDL_mutex *mutex;
+  SDL_cond *cond;
+} OldPacketQueue;
+
+static void old_packet_queue_init(OldPacketQueue *q) {
+  memset(q, 0, sizeof(OldPacketQueue));
+  q->mutex = SDL_CreateMutex();
+  q->cond = SDL_CreateCond();
+}
+
+static void old_packet_queue_destroy(OldPacketQueue *q) {
+  AVPacketList *pkt, *pkt1;
+
+  for (pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
+    pkt1 = pkt->next;
+    av_packet_unref(&pkt->pkt);
+    av_freep(&pkt);
+  }
+  SDL_DestroyCond(q->cond);
+  SDL_DestroyMutex(q->mutex);
+}
+
+static int old_packet_queue_put(OldPacketQueue *q, AVPacket *pkt) {
+  AVPacketList *pkt1;
+
+  pkt1 = av_malloc(sizeof(AVPacketList));
+  if (!pkt1) {
+    return -1;
+  }
+  pkt1->pkt = *pkt;
+  pkt1->next = NULL;
+
+  SDL_LockMutex(q->mutex);
+
+  if (!q->last_pkt) {
+    q->first_pkt = pkt1;
+  } else {
+    q->last_pkt->next = pkt1;
+  }
+  q->last_pkt = pkt1;
+  q->nb_packets++;
+  q->size += pkt1->pkt.size;
+  SDL_CondSignal(q->cond);
+
+  SDL_UnlockMutex(q->mutex);
+  return 0;
+}
+
+static int old_packet_queue_get(OldPacketQueue *q, AVPacket *pkt) {
+  AVPacketList *pkt1;
+
+  SDL_LockMutex(q->mutex);
+  while (!(pkt1 = q->first_pkt)) {
+    SDL_CondWait(q->cond, q->mutex);
+  }
+  q->first_pkt = pkt1->next;
+  if (!q->first_pkt) {
+    q->last_pkt = NULL;
+  }
+  q->nb_packets--;
+  q->size -= pkt1->pkt.size;
+  *pkt = pkt1->pkt;
+  av_free(pkt1);
+  SDL_UnlockMutex(q->mutex);
+  return 1;
+}
+
+typedef struct Bench {
+  VideoState *is;
+  PacketQueue queue;
+  OldPacketQueue old_queue;
+  AVPacket src;    /* every queued packet references its buffer */
+  int nb_packets;
+} Bench;
+
+static void bench_fail(void) {
+  fprintf(stderr, "out of memory\n");
+  exit(1);
+}
+
+static void *old_producer(void *arg) {
+  Bench *b = arg;
+  AVPacket pkt;
+  int i;
+
+  for (i = 0; i < b->nb_packets; i++) {
+    if (av_packet_ref(&pkt, &b->src) < 0 || old_packet_queue_put(&b->old_queue, &pkt) < 0) {
+      bench_fail();
+    }
+  }
+  return NULL;
+}
+
+static void *old_consumer(void *arg) {
+  Bench *b = arg;
+  AVPacket pkt;
+  int i;
+
+  for (i = 0; i < b->nb_packets; i++) {
+    old_packet_queue_get(&b->old_queue, &pkt);
+    av_packet_unref(&pkt);
+  }
+  return NULL;
+}
+
+static void *producer(void *arg) {
+  Bench *b = arg;
+  AVPacket pkt;
+  int i;
+
+  for (i = 0; i < b->nb_packets; i++) {
+    if (av_packet_ref(&pkt, &b->src) < 0 || packet_queue_put(b->is, &b->queue, &pkt) < 0) {
+      bench_fail();
+    }
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg) {
+  Bench *b = arg;
+  AVPacket pkt;
+  int i;
+
+  for (i = 0; i < b->nb_packets; i++) {
+    if (packet_queue_get(b->is, &b->queue, &pkt, 1, NULL) < 0) {
+      break;
+    }
+    av_packet_unref(&pkt);
+  }
+  return NULL;
+}
+
+/* Runs both threads to completion and returns the packets per second */
+static double bench_run(Bench *b, void *(*produce)(void *), void *(*consume)(void *)) {
+  pthread_t producer_tid, consumer_tid;
+  int64_t start, elapsed;
+
+  start = av_gettime_relative();
+  pthread_create(&consumer_tid, NULL, consume, b);
+  pthread_create(&producer_tid, NULL, produce, b);
+  pthread_join(producer_tid, NULL);
+  pthread_join(consumer_tid, NULL);
+  elapsed = av_gettime_relative() - start;
+
+  return elapsed > 0 ? b->nb_packets * 1000000.0 / elapsed : 0;
+}
+
+int main(int argc, char *argv[]) {
+  Bench b;
+  int packet_size;
+  double old_rate, rate;
+
+  memset(&b, 0, sizeof(b));
+  b.nb_packets = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_PACKETS;
+  packet_size = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_PACKET_SIZE;
+  if (b.nb_packets <= 0 || packet_size <= 0) {
+    fprintf(stderr, "usage: %s [packets] [packet size]\n", argv[0]);
+    return 1;
+  }
+
+  b.is = av_mallocz(sizeof(VideoState));
+  if (!b.is || av_new_packet(&b.src, packet_size) < 0 ||
+      packet_queue_init(&b.queue, (AVRational){1, 1000}) < 0) {
+    bench_fail();
+  }
+  old_packet_queue_init(&b.old_queue);
+
+  old_rate = bench_run(&b, old_producer, old_consumer);
+  rate = bench_run(&b, producer, consumer);
+
+  printf("%d packets of %d bytes\n", b.nb_packets, packet_size);
+  printf("AVPacketList queue: %12.0f packets/s\n", old_rate);
+  printf("SPSC ring:          %12.0f packets/s\n", rate);
+  if (old_rate > 0) {
+    printf("speedup:            %12.2fx\n", rate / old_rate);
+  }
+
+  packet_queue_destroy(&b.queue);
+  old_packet_queue_destroy(&b.old_queue);
+  av_packet_unref(&b.src);
+  av_free(b.is);
+  return 0;
+}
@@ -0,0 +1,268 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/error.h>
+#include <libavutil/common.h>
+
+#include <fd_io.h>
+
+typedef struct FdIO {
+  int fd;
+  int64_t start;    /* offset of the window in the file */
+  int64_t size;     /* size of the window, -1 if unknown */
+  int64_t pos;      /* read position inside the window */
+  int seekable;
+  uint8_t *map;     /* mapping of the window, NULL when reading with pread */
+  size_t map_size;
+  int64_t map_delta; /* start of the window inside the page aligned mapping */
+  int64_t hinted;   /* end of the range the kernel was told to prefetch */
+} FdIO;
+
+/* Ask the kernel to prefetch ahead of the read position */
+static void fd_io_readahead(FdIO *io) {
+  int64_t len;
+
+  if (!io->seekable || io->size < 0) {
+    return;
+  }
+
+  if (io->hinted < io->pos || io->hinted > io->pos + FD_IO_READAHEAD) {
+    /* after a seek */
+    io->hinted = io->pos;
+  } else if (io->hinted - io->pos > FD_IO_READAHEAD / 2) {
+    return;
+  }
+
+  len = FFMIN(FD_IO_READAHEAD, io->size - io->hinted);
+  if (len <= 0) {
+    return;
+  }
+
+  if (io->map) {
+    long page = sysconf(_SC_PAGESIZE);
+    int64_t from = (io->map_delta + io->hinted) & ~((int64_t) page - 1);
+    madvise(io->map + from, (size_t) (io->map_delta + io->hinted + len - from), MADV_WILLNEED);
+  } else {
+    posix_fadvise(io->fd, io->start + io->hinted, len, POSIX_FADV_WILLNEED);
+  }
+  io->hinted += len;
+}
+
+static int fd_io_map(FdIO *io) {
+  long page = sysconf(_SC_PAGESIZE);
+  int64_t aligned = io->start & ~((int64_t) page - 1);
+  void *map;
+
+  if (io->size <= 0 || (uint64_t) (io->start - aligned + io->size) > SIZE_MAX) {
+    return -1;
+  }
+
+  io->map_delta = io->start - aligned;
+  io->map_size = (size_t) (io->map_delta + io->size);
+  map = mmap(NULL, io->map_size, PROT_READ, MAP_SHARED, io->fd, (off_t) aligned);
+  if (map == MAP_FAILED) {
+    /* e.g. not enough address space for a large file on 32 bit */
+    io->map_size = 0;
+    io->map_delta = 0;
+    return -1;
+  }
+
+  io->map = map;
+  madvise(io->map, io->map_size, MADV_SEQUENTIAL);
+  return 0;
+}
+
+static int fd_io_read(void *opaque, uint8_t *buf, int buf_size) {
+  FdIO *io = (FdIO *) opaque;
+  ssize_t ret;
+
+  if (io->size >= 0) {
+    if (io->pos >= io->size) {
+      return AVERROR_EOF;
+    }
+    buf_size = (int) FFMIN(buf_size, io->size - io->pos);
+  }
+
+  fd_io_readahead(io);
+
+  if (io->map) {
+    memcpy(buf, io->map + io->map_delta + io->pos, buf_size);
+    io->pos += buf_size;
+    return buf_size;
+  }
+
+  do {
+    if (io->seekable) {
+      ret = pread(io->fd, buf, buf_size, io->start + io->pos);
+    } else {
+      ret = read(io->fd, buf, buf_size);
+    }
+  } while (ret < 0 && errno == EINTR);
+
+  if (ret < 0) {
+    return AVERROR(errno);
+  } else if (ret == 0) {
+    return AVERROR_EOF;
+  }
+
+  io->pos += ret;
+  return (int) ret;
+}
+
+static int64_t fd_io_seek(void *opaque, int64_t offset, int whence) {
+  FdIO *io = (FdIO *) opaque;
+  int64_t pos;
+
+  whence &= ~AVSEEK_FORCE;
+
+  if (whence == AVSEEK_SIZE) {
+    return io->size >= 0 ? io->size : AVERROR(ENOSYS);
+  }
+
+  if (!io->seekable) {
+    return AVERROR(ESPIPE);
+  }
+
+  switch (whence) {
+  case SEEK_SET:
+    pos = offset;
+    break;
+  case SEEK_CUR:
+    pos = io->pos + offset;
+    break;
+  case SEEK_END:
+    if (io->size < 0) {
+      return AVERROR(ENOSYS);
+    }
+    pos = io->size + offset;
+    break;
+  default:
+    return AVERROR(EINVAL);
+  }
+
+  if (pos < 0 || (io->size >= 0 && pos > io->size)) {
+    return AVERROR(EINVAL);
+  }
+
+  io->pos = pos;
+  return pos;
+}
+
+AVIOContext *fd_io_open(int fd, int64_t offset, int64_t length, int flags) {
+  AVIOContext *pb;
+  unsigned char *buffer;
+  struct stat st;
+  int regular;
+  FdIO *io;
+
+  io = av_mallocz(sizeof(FdIO));
+  if (!io) {
+    return NULL;
+  }
+
+  io->fd = fd;
+  io->start = FFMAX(offset, 0);
+  io->size = -1;
+
+  regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+  if (regular) {
+    int64_t available = FFMAX(st.st_size - io->start, 0);
+
+    io->seekable = 1;
+    io->size = (length > 0 && length < available) ? length : available;
+  } else if (lseek(fd, io->start, SEEK_SET) < 0) {
+    /* a pipe or socket, skip to the start of the window by reading */
+    uint8_t skip[4096];
+    int64_t left = io->start;
+
+    while (left > 0) {
+      ssize_t ret = read(fd, skip, (size_t) FFMIN(left, (int64_t) sizeof(skip)));
+      if (ret <= 0) {
+        if (ret < 0 && errno == EINTR) {
+          continue;
+        }
+        av_free(io);
+        return NULL;
+      }
+      left -= ret;
+    }
+    io->size = length > 0 ? length : -1;
+  } else {
+    /* seekable but not a regular file, e.g. a block device */
+    io->seekable = 1;
+    io->size = length > 0 ? length : -1;
+  }
+
+  if (io->seekable && io->size > 0) {
+    posix_fadvise(fd, io->start, io->size, POSIX_FADV_SEQUENTIAL);
+    if ((flags & FD_IO_MMAP) && regular) {
+      fd_io_map(io);
+    }
+  }
+
+  buffer = av_malloc(FD_IO_BUFFER_SIZE);
+  if (!buffer) {
+    if (io->map) {
+      munmap(io->map, io->map_size);
+    }
+    av_free(io);
+    return NULL;
+  }
+
+  pb = avio_alloc_context(buffer, FD_IO_BUFFER_SIZE, 0, io, fd_io_read, NULL, fd_io_seek);
+  if (!pb) {
+    if (io->map) {
+      munmap(io->map, io->map_size);
+    }
+    av_free(buffer);
+    av_free(io);
+    return NULL;
+  }
+  pb->seekable = io->seekable ? AVIO_SEEKABLE_NORMAL : 0;
+  /* a read from the mapping is a memcpy, skip the intermediate buffer */
+  pb->direct = io->map != NULL;
+
+  return pb;
+}
+
+void fd_io_close(AVIOContext **pb) {
+  FdIO *io;
+
+  if (!pb || !*pb) {
+    return;
+  }
+
+  io = (FdIO *) (*pb)->opaque;
+  if (io && io->map) {
+    munmap(io->map, io->map_size);
+  }
+
+  /* the descriptor is owned by the player, not by the context */
+  av_freep(&(*pb)->opaque);
+  av_freep(&(*pb)->buffer);
+  avio_context_free(pb);
+}
@@ -0,0 +1,49 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FD_IO_H_
+#define FD_IO_H_
+
+#include <libavformat/avio.h>
+
+#define FD_IO_BUFFER_SIZE 32768
+/* how far ahead of the read position the kernel is asked to prefetch */
+#define FD_IO_READAHEAD (2 * 1024 * 1024)
+
+/* fd_io_open flags */
+#define FD_IO_MMAP 0x1  /* serve reads from a mapping of the window if possible */
+
+/*
+ * AVIOContext reading the window [offset, offset + length) of a file
+ * descriptor with pread, so the input stays seekable and several readers
+ * can share the descriptor. A length <= 0 or past the end of the file
+ * extends the window to the end of the file. Descriptors that cannot seek
+ * (pipes, sockets) are read sequentially.
+ *
+ * With FD_IO_MMAP a regular file is mapped and the context is put in
+ * direct mode, so avio_read copies straight from the mapping into the
+ * caller's buffer. If the mapping fails the context falls back to pread.
+ * A mapped file must not be truncated or go away with its storage while it
+ * is read: touching a page past the new end raises SIGBUS, which a library
+ * cannot recover from without owning the signal handlers of the process.
+ * bench/fd_io_bench measures what the mapping gains over pread.
+ */
+AVIOContext *fd_io_open(int fd, int64_t offset, int64_t length, int flags);
+void fd_io_close(AVIOContext **pb);
+
+#endif /* FD_IO_H_ */
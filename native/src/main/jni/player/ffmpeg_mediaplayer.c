@@ -17,113 +17,296 @@
  */
 
 //#include <android/log.h>
+#include <fcntl.h>
 #include <ffmpeg_mediaplayer.h>
 
 static int one = 0;
 static int two = 0;
 
-void packet_queue_init(PacketQueue *q) {
-  memset(q, 0, sizeof(PacketQueue));
-  q->initialized = 1;
-  q->mutex = SDL_CreateMutex();
-  q->cond = SDL_CreateCond();
+/*
+ * The queues are full once the byte cap is reached or every open stream
+ * has buffer_max_ms queued, so a badly interleaved file cannot starve one
+ * decoder while the other queue sits at its limit.
+ */
+static int stream_queues_full(VideoState *is) {
+  if (packet_queue_size(&is->audioq) + packet_queue_size(&is->videoq) >= is->buffer_max_bytes) {
+    return 1;
+  }
+  /* a put would block on a ring without free slots */
+  if (packet_queue_nb_packets(&is->audioq) >= PACKET_QUEUE_SIZE ||
+      packet_queue_nb_packets(&is->videoq) >= PACKET_QUEUE_SIZE) {
+    return 1;
+  }
+  if (is->audioStream < 0 && is->videoStream < 0) {
+    return 0;
+  }
+  /* nothing more to read until the next seek of the preview */
+  if (is->scrubbing && is->scrub_serial == packet_queue_serial(&is->videoq)) {
+    return 1;
+  }
+  return (is->audioStream < 0 || packet_queue_duration_ms(&is->audioq) >= is->buffer_max_ms) &&
+         (is->videoStream < 0 || packet_queue_duration_ms(&is->videoq) >= is->buffer_max_ms);
 }
-int packet_queue_put(VideoState *is, PacketQueue *q, AVPacket *pkt) {
 
-  AVPacketList *pkt1;
-  if(pkt != &is->flush_pkt && av_dup_packet(pkt) < 0) {
-    return -1;
+static int stream_queues_low(VideoState *is) {
+  int min_ms = FFMIN(is->buffer_min_ms, is->buffer_max_ms);
+
+  return (is->audioStream >= 0 && packet_queue_duration_ms(&is->audioq) < min_ms) ||
+         (is->videoStream >= 0 && packet_queue_duration_ms(&is->videoq) < min_ms);
+}
+
+/*
+ * Fill in a missing packet duration from the codec parameters so the
+ * queues can account for it, e.g. for raw streams without timing.
+ */
+static void stream_packet_duration(AVStream *st, AVPacket *pkt) {
+  AVCodecContext *codecCtx = st->codec;
+
+  if (pkt->duration > 0) {
+    return;
   }
-  pkt1 = av_malloc(sizeof(AVPacketList));
-  if (!pkt1)
-    return -1;
-  pkt1->pkt = *pkt;
-  pkt1->next = NULL;
 
-  SDL_LockMutex(q->mutex);
+  if (codecCtx->codec_type == AVMEDIA_TYPE_AUDIO &&
+      codecCtx->frame_size > 0 && codecCtx->sample_rate > 0) {
+    pkt->duration = av_rescale_q(codecCtx->frame_size,
+                                 (AVRational){1, codecCtx->sample_rate}, st->time_base);
+  } else if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO &&
+             st->avg_frame_rate.num > 0 && st->avg_frame_rate.den > 0) {
+    pkt->duration = av_rescale_q(1, av_inv_q(st->avg_frame_rate), st->time_base);
+  }
+}
 
-  if (!q->last_pkt)
-    q->first_pkt = pkt1;
-  else
-    q->last_pkt->next = pkt1;
-  q->last_pkt = pkt1;
-  q->nb_packets++;
-  q->size += pkt1->pkt.size;
-  SDL_CondSignal(q->cond);
+/* Wake the demuxer, called on seek, quit and by the consumers */
+static void stream_wake_read(VideoState *is) {
+  if (!is->continue_read_mutex) {
+    return;
+  }
 
-  SDL_UnlockMutex(q->mutex);
-  return 0;
+  SDL_LockMutex(is->continue_read_mutex);
+  SDL_CondSignal(is->continue_read_cond);
+  SDL_UnlockMutex(is->continue_read_mutex);
 }
-static int packet_queue_get(VideoState *is, PacketQueue *q, AVPacket *pkt, int block)
-{
-  AVPacketList *pkt1;
-  int ret;
 
-  SDL_LockMutex(q->mutex);
+/*
+ * Completes the prepare with status, once: wakes a synchronous prepare
+ * waiting in stream_wait_prepared.
+ */
+static void stream_prepare_done(VideoState *is, int status) {
+  if (!is->prepare_mutex) {
+    return;
+  }
 
-  for(;;) {
+  SDL_LockMutex(is->prepare_mutex);
+  if (!is->prepare_done) {
+    is->prepare_done = 1;
+    is->prepare_status = status;
+    SDL_CondBroadcast(is->prepare_cond);
+  }
+  SDL_UnlockMutex(is->prepare_mutex);
+}
 
-    if(is->quit) {
-      ret = -1;
+/* Returns the prepare status, or TIMED_OUT after timeout_ms (0: no limit) */
+static int stream_wait_prepared(VideoState *is, int timeout_ms) {
+  int64_t deadline = av_gettime() + (int64_t) timeout_ms * 1000;
+  int64_t left;
+  int ret;
+
+  SDL_LockMutex(is->prepare_mutex);
+  while (!is->prepare_done) {
+    if (timeout_ms <= 0) {
+      SDL_CondWait(is->prepare_cond, is->prepare_mutex);
+      continue;
+    }
+    left = deadline - av_gettime();
+    if (left <= 0) {
       break;
     }
+    SDL_CondWaitTimeout(is->prepare_cond, is->prepare_mutex, (Uint32) ((left + 999) / 1000));
+  }
+  ret = is->prepare_done ? is->prepare_status : TIMED_OUT;
+  SDL_UnlockMutex(is->prepare_mutex);
 
-    pkt1 = q->first_pkt;
-    if (pkt1) {
-      q->first_pkt = pkt1->next;
-      if (!q->first_pkt)
-	q->last_pkt = NULL;
-      q->nb_packets--;
-      q->size -= pkt1->pkt.size;
-      *pkt = pkt1->pkt;
-      av_free(pkt1);
-      ret = 1;
-      break;
-    } else if (!block) {
-      ret = 0;
+  return ret;
+}
+
+/*
+ * Called by a decoder for each frame. The first picture may complete the
+ * prepare, so the demuxer is woken to check it.
+ */
+static void stream_frame_decoded(VideoState *is, enum AVMediaType type) {
+  int types;
+
+  for (;;) {
+    types = SDL_AtomicGet(&is->decoded_types);
+    if (types & (1 << type)) {
+      return;
+    }
+    if (SDL_AtomicCAS(&is->decoded_types, types, types | (1 << type))) {
       break;
-    } else {
-      SDL_CondWait(q->cond, q->mutex);
     }
   }
-  SDL_UnlockMutex(q->mutex);
-  return ret;
+
+  if (!types) {
+    is->open_timings.first_frame = av_gettime();
+  }
+  if (type == AVMEDIA_TYPE_VIDEO) {
+    stream_wake_read(is);
+  }
+}
+
+/*
+ * Called by a consumer after it took a packet. The demuxer is only woken
+ * once it is parked and the queues have drained far enough, so a full
+ * queue does not cost a wakeup per packet.
+ */
+static void stream_continue_read(VideoState *is) {
+  if (SDL_AtomicGet(&is->read_waiting) &&
+      !stream_queues_full(is) && stream_queues_low(is)) {
+    stream_wake_read(is);
+  }
+}
+
+/* The queue feeding the output: audio, or video for video only files */
+static PacketQueue *stream_master_queue(VideoState *is) {
+  return is->audioStream >= 0 ? &is->audioq : &is->videoq;
+}
+
+/*
+ * Compares the first frame decoded from a stream with the parameters the
+ * probe cache gave for it, and drops the entry if they disagree so the
+ * next prepare analyzes the source again.
+ */
+static void probe_cache_check(VideoState *is, AVStream *st, AVFrame *frame) {
+  AVCodecParameters *par = st->codecpar;
+  int mismatch;
+
+  if (!is->probe_cache_check[par->codec_type]) {
+    return;
+  }
+  is->probe_cache_check[par->codec_type] = 0;
+
+  if (par->codec_type == AVMEDIA_TYPE_AUDIO) {
+    mismatch = frame->sample_rate != par->sample_rate || frame->channels != par->channels;
+  } else {
+    mismatch = frame->width != par->width || frame->height != par->height;
+  }
+
+  if (mismatch) {
+    fprintf(stderr, "%s: stream %d does not match the probe cache\n", is->filename, st->index);
+    probe_cache_remove(is->probe_cache_dir, is->probe_cache_key);
+  }
 }
-static void packet_queue_flush(PacketQueue *q) {
-  AVPacketList *pkt, *pkt1;
 
-  SDL_LockMutex(q->mutex);
-  for(pkt = q->first_pkt; pkt != NULL; pkt = pkt1) {
-    pkt1 = pkt->next;
-    av_packet_unref(&pkt->pkt);
-    av_freep(&pkt);
+/*
+ * Called by the consumer of the master queue when it ran dry or dropped
+ * below the low watermark. The output is paused until the demuxer has
+ * refilled the queue up to the high watermark.
+ */
+static void stream_underrun(VideoState *is) {
+  if (is->eof || is->quit || is->scrubbing || SDL_AtomicGet(&is->buffering)) {
+    return;
   }
-  q->last_pkt = NULL;
-  q->first_pkt = NULL;
-  q->nb_packets = 0;
-  q->size = 0;
-  SDL_UnlockMutex(q->mutex);
+
+  is->buffering_start = av_gettime();
+  SDL_AtomicSet(&is->buffering, 1);
+  notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_BUFFERING_START, 0);
+  stream_wake_read(is);
 }
+
+static void stream_check_underrun(VideoState *is, PacketQueue *q) {
+  if (is->buffering_low_ms > 0 && packet_queue_duration_ms(q) < is->buffering_low_ms) {
+    stream_underrun(is);
+  }
+}
+
+/* Called by the demuxer, ends buffering once the master queue is refilled */
+static void stream_check_buffering(VideoState *is) {
+  PacketQueue *q;
+
+  if (!SDL_AtomicGet(&is->buffering)) {
+    return;
+  }
+
+  q = stream_master_queue(is);
+  if (is->eof || is->quit || stream_queues_full(is) ||
+      packet_queue_duration_ms(q) >= is->buffering_high_ms ||
+      packet_queue_nb_packets(q) >= PACKET_QUEUE_SIZE / 2) {
+    SDL_AtomicSet(&is->buffering, 0);
+    notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_BUFFERING_END, 0);
+  }
+}
+
+/*
+ * Report how far the input has been read, ext1 is the percentage of the
+ * duration and ext2 the buffered-until position in ms.
+ */
+static void stream_buffering_update(VideoState *is, int64_t buffered_until,
+                                    int *last_percent, int64_t *last_update) {
+  int64_t duration = is->pFormatCtx->duration;
+  int64_t now = av_gettime();
+  int percent = 0;
+
+  if (is->eof) {
+    percent = 100;
+  } else if (duration > 0 && buffered_until > 0) {
+    percent = (int) FFMIN(buffered_until * 100 / duration, 100);
+  }
+
+  if (percent == *last_percent && now - *last_update < BUFFERING_UPDATE_INTERVAL) {
+    return;
+  }
+
+  *last_percent = percent;
+  *last_update = now;
+  notify_from_thread(is, MEDIA_BUFFERING_UPDATE, percent, (int) (buffered_until / 1000));
+}
+
+/*
+ * Park the demuxer until a consumer, a seek or quit wakes it, or until
+ * timeout ms have passed when timeout is not 0. The queue state is checked
+ * again under the lock so a wakeup between the caller's check and the wait
+ * is not lost.
+ */
+static void stream_wait_read(VideoState *is, Uint32 timeout) {
+  SDL_LockMutex(is->continue_read_mutex);
+  SDL_AtomicSet(&is->read_waiting, 1);
+  if (!is->quit && !is->seek_req) {
+    if (timeout) {
+      SDL_CondWaitTimeout(is->continue_read_cond, is->continue_read_mutex, timeout);
+    } else if (stream_queues_full(is)) {
+      SDL_CondWait(is->continue_read_cond, is->continue_read_mutex);
+    }
+  }
+  SDL_AtomicSet(&is->read_waiting, 0);
+  SDL_UnlockMutex(is->continue_read_mutex);
+}
+
 double get_audio_clock(VideoState *is) {
   double pts;
   int hw_buf_size, bytes_per_sec, n;
 
   pts = is->audio_clock; /* maintained in the audio thread */
-  hw_buf_size = is->audio_buf_size - is->audio_buf_index;
+  /* decoded but not played yet */
+  hw_buf_size = is->audio_buf_size - is->audio_buf_index + pcm_ring_fill(&is->audio_ring);
   bytes_per_sec = 0;
-  n = is->audio_st->codec->channels * 2;
   if(is->audio_st) {
-    bytes_per_sec = is->audio_st->codec->sample_rate * n;
+    n = is->audio_tgt_channels * 2;
+    bytes_per_sec = is->audio_tgt_sample_rate * n;
   }
   if(bytes_per_sec) {
     pts -= (double)hw_buf_size / bytes_per_sec;
   }
+  /* pulled by the sink but still queued on the output */
+  if (is->audio_sink) {
+    pts -= audio_sink_latency(is->audio_sink) / 1000.0;
+  }
   return pts;
 }
 double get_video_clock(VideoState *is) {
   double delta;
+  int64_t now = SDL_AtomicGet(&is->buffering) ? is->buffering_start : av_gettime();
 
-  delta = (av_gettime() - is->video_current_pts_time) / 1000000.0;
+  delta = (now - is->video_current_pts_time) / 1000000.0;
   return is->video_current_pts + delta;
 }
 double get_external_clock(VideoState *is) {
@@ -145,9 +328,11 @@ int synchronize_audio(VideoState *is, short *samples,
   int n;
   double ref_clock;
 
-  n = 2 * is->audio_st->codec->channels;
+  n = 2 * is->audio_tgt_channels;
 
-  if(is->av_sync_type != AV_SYNC_AUDIO_MASTER) {
+  /* the audio clock is meaningless until the first packet after a seek */
+  if(is->av_sync_type != AV_SYNC_AUDIO_MASTER &&
+     is->audio_clock_serial == packet_queue_serial(&is->audioq)) {
     double diff, avg_diff;
     int wanted_size, min_size, max_size /*, nb_samples */;
 
@@ -163,7 +348,7 @@ int synchronize_audio(VideoState *is, short *samples,
       } else {
 	avg_diff = is->audio_diff_cum * (1.0 - is->audio_diff_avg_coef);
 	if(fabs(avg_diff) >= is->audio_diff_threshold) {
-	  wanted_size = samples_size + ((int)(diff * is->audio_st->codec->sample_rate) * n);
+	  wanted_size = samples_size + ((int)(diff * is->audio_tgt_sample_rate) * n);
 	  min_size = samples_size * ((100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100);
 	  max_size = samples_size * ((100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100);
 	  if(wanted_size < min_size) {
@@ -200,104 +385,179 @@ int synchronize_audio(VideoState *is, short *samples,
   return samples_size;
 }
 
-int decode_frame_from_packet(VideoState *is, AVFrame decoded_frame)
+/*
+ * The format the sink plays: the requested rate and channel count, or
+ * those of the source with more than two channels downmixed to stereo,
+ * which is all the OpenSL ES buffer queue takes.
+ */
+static void audio_set_output_format(VideoState *is, AVCodecContext *codecCtx) {
+  is->audio_tgt_sample_rate = is->audio_output_sample_rate > 0 ?
+                              is->audio_output_sample_rate : codecCtx->sample_rate;
+  is->audio_tgt_channels = is->audio_output_channels > 0 ?
+                           is->audio_output_channels : FFMIN(codecCtx->channels, 2);
+}
+
+/*
+ * Convert the decoded audio of the given layout to interleaved S16 in the
+ * output format, so it is resampled once here and not again by the mixer.
+ */
+static int audio_open_resampler(VideoState *is, uint64_t channel_layout, int channels,
+                                int sample_rate, enum AVSampleFormat sample_fmt) {
+  if (channel_layout == 0) {
+    channel_layout = av_get_default_channel_layout(channels);
+  }
+
+  is->sws_ctx_audio = swr_alloc();
+  if (!is->sws_ctx_audio) {
+    fprintf(stderr, "Could not allocate resampler context\n");
+    return -1;
+  }
+
+  av_opt_set_int(is->sws_ctx_audio, "in_channel_layout", channel_layout, 0);
+  av_opt_set_int(is->sws_ctx_audio, "out_channel_layout",
+                 av_get_default_channel_layout(is->audio_tgt_channels),  0);
+  av_opt_set_int(is->sws_ctx_audio, "in_sample_rate", sample_rate, 0);
+  av_opt_set_int(is->sws_ctx_audio, "out_sample_rate", is->audio_tgt_sample_rate, 0);
+  av_opt_set_sample_fmt(is->sws_ctx_audio, "in_sample_fmt", sample_fmt, 0);
+  av_opt_set_sample_fmt(is->sws_ctx_audio, "out_sample_fmt", AV_SAMPLE_FMT_S16,  0);
+
+  switch (is->audio_resampler_quality) {
+  case RESAMPLER_QUALITY_FAST:
+    av_opt_set_int(is->sws_ctx_audio, "filter_size", 8, 0);
+    av_opt_set_int(is->sws_ctx_audio, "phase_shift", 6, 0);
+    av_opt_set_int(is->sws_ctx_audio, "linear_interp", 1, 0);
+    break;
+  case RESAMPLER_QUALITY_HIGH:
+    av_opt_set_int(is->sws_ctx_audio, "filter_size", 64, 0);
+    av_opt_set_int(is->sws_ctx_audio, "phase_shift", 12, 0);
+    av_opt_set_double(is->sws_ctx_audio, "cutoff", 0.98, 0);
+    break;
+  default:
+    break;
+  }
+
+  /* initialize the resampling context */
+  if ((swr_init(is->sws_ctx_audio)) < 0) {
+    fprintf(stderr, "Failed to initialize the resampling context\n");
+    swr_free(&is->sws_ctx_audio);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Converts a decoded frame to the output format straight into audio_buf.
+ * Anything past MAX_AUDIO_FRAME_SIZE stays buffered in the resampler for
+ * the next call, the rest of audio_buf is headroom for synchronize_audio.
+ */
+int decode_frame_from_packet(VideoState *is, AVFrame *decoded_frame)
 {
-	int64_t src_ch_layout, dst_ch_layout;
-	int src_rate, dst_rate;
-	uint8_t **src_data = NULL, **dst_data = NULL;
-	int src_nb_channels = 0, dst_nb_channels = 0;
-	int src_linesize, dst_linesize;
-	int src_nb_samples, dst_nb_samples, max_dst_nb_samples;
-	enum AVSampleFormat src_sample_fmt, dst_sample_fmt;
+	uint8_t *dst_data[1];
+	int dst_nb_channels, dst_nb_samples;
 	int dst_bufsize;
 	int ret;
 
-	src_nb_samples = decoded_frame.nb_samples;
-	src_linesize = (int) decoded_frame.linesize;
-	src_data = decoded_frame.data;
-
-	if (decoded_frame.channel_layout == 0) {
-		decoded_frame.channel_layout = av_get_default_channel_layout(decoded_frame.channels);
+	if (decoded_frame->channel_layout == 0) {
+		decoded_frame->channel_layout = av_get_default_channel_layout(decoded_frame->channels);
 	}
 
-	src_rate = decoded_frame.sample_rate;
-	dst_rate = decoded_frame.sample_rate;
-	src_ch_layout = decoded_frame.channel_layout;
-	dst_ch_layout = decoded_frame.channel_layout;
-	src_sample_fmt = decoded_frame.format;
-	dst_sample_fmt = AV_SAMPLE_FMT_S16;
-
-	/* allocate source and destination samples buffers */
-	src_nb_channels = av_get_channel_layout_nb_channels(src_ch_layout);
-	ret = av_samples_alloc_array_and_samples(&src_data, &src_linesize, src_nb_channels, src_nb_samples, src_sample_fmt, 0);
-	if (ret < 0) {
-		fprintf(stderr, "Could not allocate source samples\n");
+	/* the sample format was not known before the first frame (fast start) */
+	if (!is->sws_ctx_audio &&
+	    audio_open_resampler(is, decoded_frame->channel_layout, decoded_frame->channels,
+	                         decoded_frame->sample_rate, decoded_frame->format) < 0) {
 		return -1;
 	}
 
-	/* compute the number of converted samples: buffering is avoided
-	 * ensuring that the output buffer will contain at least all the
-	 * converted input samples */
-	max_dst_nb_samples = dst_nb_samples = av_rescale_rnd(src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
-
-	/* buffer is going to be directly written to a rawaudio file, no alignment */
-	dst_nb_channels = av_get_channel_layout_nb_channels(dst_ch_layout);
-	ret = av_samples_alloc_array_and_samples(&dst_data, &dst_linesize, dst_nb_channels, dst_nb_samples, dst_sample_fmt, 0);
-	if (ret < 0) {
-		fprintf(stderr, "Could not allocate destination samples\n");
+	dst_nb_channels = is->audio_tgt_channels;
+	if (dst_nb_channels <= 0) {
 		return -1;
 	}
-
-	/* compute destination number of samples */
-	dst_nb_samples = av_rescale_rnd(swr_get_delay(is->sws_ctx_audio, src_rate) + src_nb_samples, dst_rate, src_rate, AV_ROUND_UP);
+	dst_nb_samples = MAX_AUDIO_FRAME_SIZE / (dst_nb_channels * av_get_bytes_per_sample(AV_SAMPLE_FMT_S16));
+	dst_data[0] = is->audio_buf;
 
 	/* convert to destination format */
-	ret = swr_convert(is->sws_ctx_audio, dst_data, dst_nb_samples, (const uint8_t **)decoded_frame.data, src_nb_samples);
+	ret = swr_convert(is->sws_ctx_audio, dst_data, dst_nb_samples,
+	                  (const uint8_t **) decoded_frame->extended_data, decoded_frame->nb_samples);
 	if (ret < 0) {
 		fprintf(stderr, "Error while converting\n");
 		return -1;
 	}
 
-	dst_bufsize = av_samples_get_buffer_size(&dst_linesize, dst_nb_channels, ret, dst_sample_fmt, 1);
+	dst_bufsize = av_samples_get_buffer_size(NULL, dst_nb_channels, ret, AV_SAMPLE_FMT_S16, 1);
 	if (dst_bufsize < 0) {
 		fprintf(stderr, "Could not get sample buffer size\n");
 		return -1;
 	}
 
-	memcpy(is->audio_buf, dst_data[0], dst_bufsize);
+	return dst_bufsize;
+}
 
-	if (src_data) {
-		av_freep(&src_data[0]);
-	}
-	av_freep(&src_data);
+/* Called with the serial of what the output presents first after a seek */
+static void stream_seek_output(VideoState *is, int serial) {
+  if (is->seek_start && serial == is->seek_output_serial) {
+    is->seek_ms = (int) ((av_gettime() - is->seek_start) / 1000);
+    is->seek_start = 0;
+  }
+}
 
-	if (dst_data) {
-		av_freep(&dst_data[0]);
-	}
-	av_freep(&dst_data);
+/*
+ * Drops the decoded samples in audio_buf that precede the target of a
+ * SEEK_CLOSEST. Returns how many bytes are left at the start of audio_buf.
+ */
+static int audio_trim_to_seek_target(VideoState *is, int data_size) {
+  int n = 2 * is->audio_tgt_channels;
+  int rate = is->audio_tgt_sample_rate;
+  double end = is->audio_clock + (double) data_size / (n * rate);
+  int skip;
+
+  if (end <= is->seek_exact_pts) {
+    is->audio_clock = end;
+    return 0;
+  }
 
-	return dst_bufsize;
+  skip = (int) ((is->seek_exact_pts - is->audio_clock) * rate) * n;
+  if (skip > 0 && skip < data_size) {
+    memmove(is->audio_buf, is->audio_buf + skip, data_size - skip);
+    data_size -= skip;
+    is->audio_clock += (double) skip / (n * rate);
+  }
+  is->audio_exact_serial = -1;
+  return data_size;
+}
+
+/* Every video packet demuxed so far has been decoded and its picture consumed */
+static int stream_video_drained(VideoState *is) {
+  return !is->video_st ||
+         (packet_queue_drained(&is->videoq) && !is->pictq_size);
 }
 
 int audio_decode_frame(VideoState *is, double *pts_ptr) {
 
-  int len1, data_size = 0, n;
+  int len1, data_size = 0, n, serial;
   AVPacket *pkt = &is->audio_pkt;
   double pts;
+  RenderClock render_clock;
 
   for(;;) {
+    /* a seek flushed the queue since this packet was taken */
+    if(is->audio_pkt_serial != packet_queue_serial(&is->audioq)) {
+      is->audio_pkt_size = 0;
+    }
     while(is->audio_pkt_size > 0) {
       int got_frame = 0;
-      len1 = avcodec_decode_audio4(is->audio_st->codec, &is->audio_frame, &got_frame, pkt);
-      if(len1 < 0) {
-	/* if error, skip frame */
-	is->audio_pkt_size = 0;
-	break;
+      /* timed without the waits for packets below */
+      if(is->offline_render) {
+        render_clock_start(&render_clock);
       }
-      if (got_frame)
+      len1 = avcodec_decode_audio4(is->audio_st->codec, &is->audio_frame, &got_frame, pkt);
+      if(len1 >= 0 && got_frame)
       {
-    	  if (is->audio_frame.format != AV_SAMPLE_FMT_S16) {
-    		  data_size = decode_frame_from_packet(is, is->audio_frame);
+    	  probe_cache_check(is, is->audio_st, &is->audio_frame);
+    	  stream_frame_decoded(is, AVMEDIA_TYPE_AUDIO);
+    	  if (is->audio_frame.format != AV_SAMPLE_FMT_S16 ||
+    	      is->audio_frame.sample_rate != is->audio_tgt_sample_rate ||
+    	      is->audio_frame.channels != is->audio_tgt_channels) {
+    		  data_size = decode_frame_from_packet(is, &is->audio_frame);
     	  } else {
             data_size =
               av_samples_get_buffer_size
@@ -311,17 +571,33 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
             memcpy(is->audio_buf, is->audio_frame.data[0], data_size);
     	  }
       }
+      if(is->offline_render) {
+        render_stage_add(&is->render_stages[RENDER_STAGE_AUDIO_DECODE], &render_clock,
+                         len1 >= 0 && got_frame);
+      }
+      if(len1 < 0) {
+	/* if error, skip frame */
+	is->audio_pkt_size = 0;
+	break;
+      }
       is->audio_pkt_data += len1;
       is->audio_pkt_size -= len1;
       if(data_size <= 0) {
 	/* No data yet, get more frames */
 	continue;
       }
+      if(is->audio_pkt_serial == is->audio_exact_serial) {
+        data_size = audio_trim_to_seek_target(is, data_size);
+        if(data_size <= 0) {
+          continue;
+        }
+      }
+      stream_seek_output(is, is->audio_pkt_serial);
       pts = is->audio_clock;
       *pts_ptr = pts;
-      n = 2 * is->audio_st->codec->channels;
+      n = 2 * is->audio_tgt_channels;
       is->audio_clock += (double)data_size /
-	(double)(n * is->audio_st->codec->sample_rate);
+	(double)(n * is->audio_tgt_sample_rate);
 
       /* We have data, return it and come back for more later */
       return data_size;
@@ -332,54 +608,199 @@ int audio_decode_frame(VideoState *is, double *pts_ptr) {
     if(is->quit) {
       return -1;
     }
-    /* next packet */
-    if(packet_queue_get(is, &is->audioq, pkt, 1) < 0) {
+    /* next packet, sleeps until the demuxer queued one */
+    if(packet_queue_get(is, &is->audioq, pkt, 1, &serial) < 0) {
       return -1;
     }
-    if(pkt->data == is->flush_pkt.data) {
+    stream_continue_read(is);
+    if(is->player_started) {
+      stream_check_underrun(is, &is->audioq);
+    }
+    if(serial != is->audio_pkt_serial) {
+      /* first packet after a seek, the output skips what is in the ring */
       avcodec_flush_buffers(is->audio_st->codec);
-      continue;
+      is->audio_pkt_serial = serial;
+      pcm_ring_flush(&is->audio_ring);
     }
     is->audio_pkt_data = pkt->data;
     is->audio_pkt_size = pkt->size;
     /* if update, update the audio clock w/pts */
     if(pkt->pts != AV_NOPTS_VALUE) {
       is->audio_clock = av_q2d(is->audio_st->time_base)*pkt->pts;
+      is->audio_clock_serial = serial;
     }
   }
 }
 
-void audio_callback(void *userdata, Uint8 *stream, int len) {
+/* guards VideoState.next and the start of the player it points to */
+static pthread_mutex_t next_player_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  VideoState *is = (VideoState *)userdata;
-  int len1, audio_size;
+/*
+ * Called once this player played its last samples: sends
+ * MEDIA_PLAYBACK_COMPLETE, on which MediaPlayer starts the next player if
+ * one was set. A prepared next player with the same sink and output format
+ * takes over the audio sink of this one right here instead, its samples are
+ * written to the rest of stream and the output never stops; the unused sink
+ * of the next one is released with this player. Returns 1 if the next
+ * player filled stream.
+ */
+static int stream_playback_complete(VideoState *is, uint8_t *stream, int len) {
+  VideoState *next;
+  AudioSink *sink = is->audio_sink;
+  int ret = 0;
+
+  if (!is->completed) {
+    is->completed = 1;
+    if (is->offline_render) {
+      is->render_end = av_gettime_relative();
+      render_stages_log(is->render_stages, is->render_end - is->render_start, is->filename);
+    }
+    notify_from_thread(is, MEDIA_PLAYBACK_COMPLETE, 0, 0);
+  }
+
+  pthread_mutex_lock(&next_player_lock);
+  next = is->next;
+
+  /* stop() sets quit before it tears the audio sink down */
+  if (!next || is->loop || is->quit || next->quit || !next->prepared) {
+    pthread_mutex_unlock(&next_player_lock);
+    return 0;
+  }
+
+  if (next->player_started) {
+    /* started on its own output */
+    is->next = NULL;
+  } else if (sink && stream && next->audio_sink &&
+             next->audio_sink->ops == sink->ops &&
+             next->audio_sink->channels == sink->channels &&
+             next->audio_sink->sample_rate == sink->sample_rate) {
+    is->next = NULL;
+    is->audio_sink = next->audio_sink;
+    is->audio_sink->state = is;
+    next->audio_sink = sink;
+    sink->state = next;
+
+    next->paused = 0;
+    next->player_started = 1;
+    notify_from_thread(next, MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0);
+
+    next->audio_callback(next, stream, len);
+    ret = 1;
+  }
+  pthread_mutex_unlock(&next_player_lock);
+  return ret;
+}
+
+/*
+ * Decodes ahead of the audio output into audio_ring, so the buffer queue
+ * callback only copies samples and a slow frame does not stall the device.
+ */
+int audio_thread(void *arg) {
+  VideoState *is = (VideoState *)arg;
+  int audio_size, len1;
   double pts;
 
-  while(len > 0) {
+  for(;;) {
     if(is->audio_buf_index >= is->audio_buf_size) {
-      /* We have already sent all our data; get more */
       audio_size = audio_decode_frame(is, &pts);
       if(audio_size < 0) {
-	/* If error, output silence */
-	is->audio_buf_size = 1024;
-	memset(is->audio_buf, 0, is->audio_buf_size);
-      } else {
-	audio_size = synchronize_audio(is, (int16_t *)is->audio_buf,
-				       audio_size, pts);
-	is->audio_buf_size = audio_size;
+        /* quit */
+        break;
       }
+      is->audio_buf_size = synchronize_audio(is, (int16_t *)is->audio_buf,
+                                             audio_size, pts);
       is->audio_buf_index = 0;
     }
-    len1 = is->audio_buf_size - is->audio_buf_index;
-    if(len1 > len)
-      len1 = len;
-    memcpy(stream, (uint8_t *)is->audio_buf + is->audio_buf_index, len1);
-    len -= len1;
-    stream += len1;
+    /* decoded before a seek */
+    if(is->audio_pkt_serial != packet_queue_serial(&is->audioq)) {
+      is->audio_buf_index = is->audio_buf_size;
+      continue;
+    }
+    len1 = pcm_ring_write(&is->audio_ring, is->audio_buf + is->audio_buf_index,
+                          is->audio_buf_size - is->audio_buf_index);
     is->audio_buf_index += len1;
+    if(is->audio_buf_index < is->audio_buf_size) {
+      pcm_ring_wait(&is->audio_ring);
+    }
+    if(is->quit) {
+      break;
+    }
   }
+  return 0;
+}
+
+void audio_callback(void *userdata, Uint8 *stream, int len) {
 
-  //notify_from_thread(is, MEDIA_BUFFERING_UPDATE, 0, 0);
+  VideoState *is = (VideoState *)userdata;
+  int len1, stale;
+
+  /* drop what is left of the samples decoded before a seek */
+  stale = is->audio_pkt_serial != packet_queue_serial(&is->audioq);
+  if(stale) {
+    pcm_ring_drop(&is->audio_ring);
+  }
+
+  /* output silence while the queue refills or the seek bar is dragged */
+  if(SDL_AtomicGet(&is->buffering) || is->scrubbing) {
+    memset(stream, 0, len);
+    return;
+  }
+
+  len1 = pcm_ring_read(&is->audio_ring, stream, len);
+  if(len1 < len) {
+    if(is->eof && packet_queue_drained(&is->audioq)) {
+      if(stream_playback_complete(is, stream + len1, len - len1)) {
+        return;
+      }
+    } else if(!stale) {
+      is->audio_underruns++;
+      if(!packet_queue_nb_packets(&is->audioq)) {
+        stream_underrun(is);
+      }
+    }
+    memset(stream + len1, 0, len - len1);
+  }
+}
+
+/*
+ * The last samples were played and no next player took over the sink, so
+ * there is nothing to pull until a seek restarts the output.
+ */
+int audio_output_done(VideoState *is) {
+  return is->completed && !is->next && !is->quit;
+}
+
+/*
+ * Whether audio_callback has len bytes of samples to hand out, or nothing
+ * more will come. Sinks that do not play in real time wait for this
+ * instead of pulling silence while the decoder is behind.
+ */
+int audio_samples_ready(VideoState *is, int len) {
+  if(is->quit) {
+    return 1;
+  }
+  if(audio_output_done(is)) {
+    return 0;
+  }
+  if(SDL_AtomicGet(&is->buffering) || is->scrubbing) {
+    return 0;
+  }
+  if(pcm_ring_fill(&is->audio_ring) >= len) {
+    return 1;
+  }
+  /* an offline render ends once the video is done as well */
+  return is->eof && packet_queue_drained(&is->audioq) &&
+         (!is->offline_render || stream_video_drained(is));
+}
+
+/* audio_callback of offline render mode, also hands the samples on */
+static void audio_render_callback(void *userdata, Uint8 *stream, int len) {
+  VideoState *is = (VideoState *)userdata;
+
+  audio_callback(userdata, stream, len);
+  if(is->render_audio) {
+    is->render_audio(is->render_opaque, stream, len);
+  }
 }
 
 void video_refresh_timer(void *userdata);
@@ -431,7 +852,7 @@ void video_display(VideoState *is) {
     SDL_DisplayYUVOverlay(vp->bmp, &rect);*/
 
     displayBmp(&is->video_player, vp->bmp, is->video_st->codec, is->video_st->codec->width, is->video_st->codec->height);
-    free(vp->bmp->buffer);
+    av_freep(&vp->bmp->buffer);
   }
 }
 
@@ -502,17 +923,112 @@ void video_display(VideoState *is) {
 //	}
 //}
 
+/*
+ * The refresh thread of offline render mode: each picture goes to the
+ * render callback as soon as it is converted, nothing waits for its
+ * presentation time or for the audio clock.
+ */
+static void video_render(VideoState *is) {
+  VideoPicture *vp;
+
+  for(;;) {
+    SDL_LockMutex(is->pictq_mutex);
+    if(!is->quit && (!is->player_started || is->paused || !is->pictq_size)) {
+      /* woken by queue_picture, start, pause and the end are polled */
+      SDL_CondWaitTimeout(is->pictq_cond, is->pictq_mutex, 10);
+    }
+    SDL_UnlockMutex(is->pictq_mutex);
+
+    if(is->quit) {
+      break;
+    }
+    if(!is->player_started || is->paused) {
+      continue;
+    }
+    if(!is->pictq_size) {
+      /* with audio the output reports the end once the video is drained too */
+      if(is->audioStream < 0 && is->eof && !is->completed && stream_video_drained(is)) {
+        stream_playback_complete(is, NULL, 0);
+      }
+      continue;
+    }
+
+    vp = &is->pictq[is->pictq_rindex];
+    if(vp->serial == packet_queue_serial(&is->videoq)) {
+      is->video_current_pts = vp->pts;
+      is->video_current_pts_time = av_gettime();
+      if(is->render_video && vp->bmp) {
+        is->render_video(is->render_opaque, vp->bmp->buffer, vp->bmp->linesize,
+                         vp->width, vp->height, vp->pts);
+      }
+    }
+    /* updateBmp allocates a buffer per picture, shown or dropped */
+    if(vp->bmp) {
+      av_freep(&vp->bmp->buffer);
+    }
+
+    if(++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+      is->pictq_rindex = 0;
+    }
+    SDL_LockMutex(is->pictq_mutex);
+    is->pictq_size--;
+    SDL_CondSignal(is->pictq_cond);
+    SDL_UnlockMutex(is->pictq_mutex);
+  }
+}
+
 void video_refresh_timer(void *opaque) {
 	VideoState *is = (VideoState *)opaque;
 
 	VideoPicture *vp;
 	double actual_delay, delay, sync_threshold, ref_clock, diff;
+	int64_t paused_at = 0, stalled;
+
+	if(is->offline_render) {
+		video_render(is);
+		return;
+	}
 
     for(;;) {
 	    if(is->quit) {
 	        break;
 	    }
 
+	    /*
+	     * decoded before a seek, drop it without waiting, paused or not,
+	     * so the video thread and the demuxer behind it are not held up
+	     */
+	    if(is->video_st && is->pictq_size > 0) {
+	        vp = &is->pictq[is->pictq_rindex];
+	        if(vp->serial != packet_queue_serial(&is->videoq)) {
+	            if(vp->bmp) {
+	                av_freep(&vp->bmp->buffer);
+	            }
+	            if(++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+	                is->pictq_rindex = 0;
+	            }
+	            SDL_LockMutex(is->pictq_mutex);
+	            is->pictq_size--;
+	            SDL_CondSignal(is->pictq_cond);
+	            SDL_UnlockMutex(is->pictq_mutex);
+	            continue;
+	        }
+	    }
+
+	    /* hold the picture and the video clock while buffering or paused */
+	    if(!is->scrubbing && (SDL_AtomicGet(&is->buffering) || is->paused || !is->player_started)) {
+	        if(!paused_at) {
+	            paused_at = SDL_AtomicGet(&is->buffering) ? is->buffering_start : av_gettime();
+	        }
+	        SDL_Delay(10);
+	        continue;
+	    } else if(paused_at) {
+	        stalled = av_gettime() - paused_at;
+	        is->frame_timer += stalled / 1000000.0;
+	        is->video_current_pts_time += stalled;
+	        paused_at = 0;
+	    }
+
 	    if(is->video_st) {
 	        if(is->pictq_size == 0) {
 	          //schedule_refresh(is, 1);
@@ -521,9 +1037,29 @@ void video_refresh_timer(void *opaque) {
 	        } else {
 	          vp = &is->pictq[is->pictq_rindex];
 
+	          /* first picture after a seek, restart the frame timer */
+	          if(vp->serial != is->video_clock_serial) {
+	            is->frame_timer = av_gettime() / 1000000.0;
+	            is->frame_last_pts = vp->pts;
+	            is->video_clock_serial = vp->serial;
+	          }
+
 	          is->video_current_pts = vp->pts;
 	          is->video_current_pts_time = av_gettime();
 
+	          /* a preview is shown as soon as it is decoded, paused or not */
+	          if(is->scrubbing) {
+	            video_display(is);
+	            if(++is->pictq_rindex == VIDEO_PICTURE_QUEUE_SIZE) {
+	              is->pictq_rindex = 0;
+	            }
+	            SDL_LockMutex(is->pictq_mutex);
+	            is->pictq_size--;
+	            SDL_CondSignal(is->pictq_cond);
+	            SDL_UnlockMutex(is->pictq_mutex);
+	            continue;
+	          }
+
 	          delay = vp->pts - is->frame_last_pts; /* the pts from last time */
 	          if(delay <= 0 || delay >= 1.0) {
 	    	/* if incorrect delay, use previous one */
@@ -605,7 +1141,7 @@ void alloc_picture(void *userdata) {
 
 }
 
-int queue_picture(VideoState *is, AVFrame *pFrame, double pts) {
+int queue_picture(VideoState *is, AVFrame *pFrame, double pts, int serial) {
 
   VideoPicture *vp;
   //int dst_pix_fmt;
@@ -653,14 +1189,26 @@ int queue_picture(VideoState *is, AVFrame *pFrame, double pts) {
      but still return vp->allocated = 1? */
 
 
-  if(vp->bmp) {
+  if(!is->sws_ctx) {
+    is->sws_ctx = createScaler(&is->video_player, is->video_st->codec);
+  }
+
+  if(vp->bmp && is->sws_ctx) {
+    RenderClock render_clock;
 
     //dst_pix_fmt = PIX_FMT_YUV420P;
     /* point pict at the queue */
 
+    if(is->offline_render) {
+      render_clock_start(&render_clock);
+    }
     updateBmp(&is->video_player, is->sws_ctx, is->video_st->codec, vp->bmp, pFrame, is->video_st->codec->width, is->video_st->codec->height);
+    if(is->offline_render) {
+      render_stage_add(&is->render_stages[RENDER_STAGE_VIDEO_CONVERT], &render_clock, 1);
+    }
 
     vp->pts = pts;
+    vp->serial = serial;
 
     /* now we inform our display thread that we have a pic ready */
     if(++is->pictq_windex == VIDEO_PICTURE_QUEUE_SIZE) {
@@ -668,6 +1216,7 @@ int queue_picture(VideoState *is, AVFrame *pFrame, double pts) {
     }
     SDL_LockMutex(is->pictq_mutex);
     is->pictq_size++;
+    SDL_CondSignal(is->pictq_cond);
     SDL_UnlockMutex(is->pictq_mutex);
   }
   return 0;
@@ -712,25 +1261,48 @@ int video_thread(void *arg) {
   int frameFinished;
   AVFrame *pFrame;
   double pts;
+  int serial;
+  RenderClock render_clock;
 
   pFrame = av_frame_alloc();
 
   for(;;) {
-    if(packet_queue_get(is, &is->videoq, packet, 1) < 0) {
+    /* without audio the video queue feeds the output */
+    if(is->audioStream < 0 && !packet_queue_nb_packets(&is->videoq)) {
+      stream_underrun(is);
+    }
+    if(packet_queue_get(is, &is->videoq, packet, 1, &serial) < 0) {
       // means we quit getting packets
       break;
     }
-    if(packet->data == is->flush_pkt.data) {
+    stream_continue_read(is);
+    if(is->audioStream < 0) {
+      stream_check_underrun(is, &is->videoq);
+    }
+    if(serial != is->video_pkt_serial) {
+      /* first packet after a seek */
       avcodec_flush_buffers(is->video_st->codec);
+      is->video_pkt_serial = serial;
+    }
+    /* the preview of a seek is its first keyframe */
+    if(is->scrubbing && serial == is->scrub_serial) {
+      av_packet_unref(packet);
       continue;
     }
+    is->video_st->codec->skip_frame = is->scrubbing ? AVDISCARD_NONKEY : AVDISCARD_DEFAULT;
     pts = 0;
 
     // Save global pts to be stored in pFrame in first call
     global_video_pkt_pts = packet->pts;
     // Decode video frame
+    if(is->offline_render) {
+      render_clock_start(&render_clock);
+    }
     avcodec_decode_video2(is->video_st->codec, pFrame, &frameFinished,
 				packet);
+    if(is->offline_render) {
+      render_stage_add(&is->render_stages[RENDER_STAGE_VIDEO_DECODE], &render_clock, frameFinished != 0);
+    }
     if(packet->dts == AV_NOPTS_VALUE
        && pFrame->opaque && *(uint64_t*)pFrame->opaque != AV_NOPTS_VALUE) {
       pts = *(uint64_t *)pFrame->opaque;
@@ -741,12 +1313,30 @@ int video_thread(void *arg) {
     }
     pts *= av_q2d(is->video_st->time_base);
 
-    // Did we get a video frame?
+    // Did we get a video frame? Skip it if a seek happened meanwhile
     if(frameFinished) {
+      probe_cache_check(is, is->video_st, pFrame);
+    }
+    if(frameFinished && serial == packet_queue_serial(&is->videoq)) {
       pts = synchronize_video(is, pFrame, pts);
-      if(queue_picture(is, pFrame, pts) < 0) {
+      /* frames before the target of a SEEK_CLOSEST are only references */
+      if(serial == is->video_exact_serial) {
+        if(is->video_clock <= is->seek_exact_pts) {
+          av_packet_unref(packet);
+          continue;
+        }
+        is->video_exact_serial = -1;
+      }
+      if(queue_picture(is, pFrame, pts, serial) < 0) {
 	break;
       }
+      if(is->scrubbing) {
+        is->scrub_serial = serial;
+      }
+      stream_frame_decoded(is, AVMEDIA_TYPE_VIDEO);
+      if(is->audioStream < 0) {
+        stream_seek_output(is, serial);
+      }
     }
     av_packet_unref(packet);
   }
@@ -755,6 +1345,18 @@ int video_thread(void *arg) {
   two = 1;
   return 0;
 }
+
+/* offline render mode takes the audio as fast as it is decoded */
+static int stream_audio_sink_type(VideoState *is) {
+  if (!is->offline_render) {
+    return is->audio_sink_type;
+  }
+  if (is->audio_sink_type == AUDIO_SINK_WAV || is->audio_sink_type == AUDIO_SINK_WAV_UNTHROTTLED) {
+    return AUDIO_SINK_WAV_UNTHROTTLED;
+  }
+  return AUDIO_SINK_NULL_UNTHROTTLED;
+}
+
 int stream_component_open(VideoState *is, int stream_index) {
 
   AVFormatContext *pFormatCtx = is->pFormatCtx;
@@ -770,13 +1372,27 @@ int stream_component_open(VideoState *is, int stream_index) {
   codecCtx = pFormatCtx->streams[stream_index]->codec;
 
   if(codecCtx->codec_type == AVMEDIA_TYPE_AUDIO) {
-	is->audio_callback = audio_callback;
+	is->audio_callback = is->offline_render ? audio_render_callback : audio_callback;
 
     // Set audio settings from codec info
-	AudioPlayer *player = malloc(sizeof(AudioPlayer));
-    is->audio_player = player;
-    createEngine(&is->audio_player);
-    createBufferQueueAudioPlayer(&is->audio_player, is, codecCtx->channels, codecCtx->sample_rate, is->stream_type);
+	audio_set_output_format(is, codecCtx);
+	AudioSink *sink = audio_sink_alloc(stream_audio_sink_type(is));
+	if (!sink) {
+		return -1;
+	}
+	sink->state = is;
+	sink->channels = is->audio_tgt_channels;
+	sink->sample_rate = is->audio_tgt_sample_rate;
+	sink->stream_type = is->stream_type;
+	sink->buffer_count = is->audio_buffer_count;
+	sink->buffer_ms = is->audio_buffer_ms;
+	av_strlcpy(sink->path, is->audio_sink_path, sizeof(sink->path));
+	if (audio_sink_open(sink) < 0) {
+		fprintf(stderr, "Could not open the %s audio sink\n", sink->ops->name);
+		audio_sink_free(&sink);
+		return -1;
+	}
+	is->audio_sink = sink;
     //is->audio_hw_buf_size = 4096;
   } else if (codecCtx->codec_type == AVMEDIA_TYPE_VIDEO) {
 	// Set video settings from codec info
@@ -802,35 +1418,27 @@ int stream_component_open(VideoState *is, int stream_index) {
     is->audio_diff_avg_coef = exp(log(0.01 / AUDIO_DIFF_AVG_NB));
     is->audio_diff_avg_count = 0;
     /* Correct audio only if larger error than this */
-    is->audio_diff_threshold = 2.0 * SDL_AUDIO_BUFFER_SIZE / codecCtx->sample_rate;
+    is->audio_diff_threshold = 2.0 * SDL_AUDIO_BUFFER_SIZE / is->audio_tgt_sample_rate;
 
-	is->sws_ctx_audio = swr_alloc();
-	if (!is->sws_ctx_audio) {
-		fprintf(stderr, "Could not allocate resampler context\n");
+	/* otherwise opened on the first decoded frame */
+	if (codecCtx->sample_fmt != AV_SAMPLE_FMT_NONE &&
+	    audio_open_resampler(is, codecCtx->channel_layout, codecCtx->channels,
+	                         codecCtx->sample_rate, codecCtx->sample_fmt) < 0) {
 		return -1;
 	}
 
-	uint64_t channel_layout = is->audio_st->codec->channel_layout;
-
-	if (channel_layout == 0) {
-		channel_layout = av_get_default_channel_layout(is->audio_st->codec->channels);
-	}
-
-	av_opt_set_int(is->sws_ctx_audio, "in_channel_layout", channel_layout, 0);
-	av_opt_set_int(is->sws_ctx_audio, "out_channel_layout", channel_layout,  0);
-	av_opt_set_int(is->sws_ctx_audio, "in_sample_rate", is->audio_st->codec->sample_rate, 0);
-	av_opt_set_int(is->sws_ctx_audio, "out_sample_rate", is->audio_st->codec->sample_rate, 0);
-	av_opt_set_sample_fmt(is->sws_ctx_audio, "in_sample_fmt", is->audio_st->codec->sample_fmt, 0);
-	av_opt_set_sample_fmt(is->sws_ctx_audio, "out_sample_fmt", AV_SAMPLE_FMT_S16,  0);
+    memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
+    if (packet_queue_init(&is->audioq, is->audio_st->time_base) < 0) {
+      return -1;
+    }
+    if (pcm_ring_init(&is->audio_ring, is->audio_tgt_sample_rate * is->audio_tgt_channels * 2 / 1000 * AUDIO_RING_MS) < 0) {
+      return -1;
+    }
+    is->audio_underruns = 0;
 
-	/* initialize the resampling context */
-	if ((swr_init(is->sws_ctx_audio)) < 0) {
-		fprintf(stderr, "Failed to initialize the resampling context\n");
-		return -1;
-	}
+    is->audio_tid = malloc(sizeof(*(is->audio_tid)));
 
-    memset(&is->audio_pkt, 0, sizeof(is->audio_pkt));
-    packet_queue_init(&is->audioq);
+    pthread_create(is->audio_tid, NULL, (void *) &audio_thread, is);
     break;
   case AVMEDIA_TYPE_VIDEO:
     is->videoStream = stream_index;
@@ -840,14 +1448,19 @@ int stream_component_open(VideoState *is, int stream_index) {
     is->frame_last_delay = 40e-3;
     is->video_current_pts_time = av_gettime();
 
-    packet_queue_init(&is->videoq);
+    if (packet_queue_init(&is->videoq, is->video_st->time_base) < 0) {
+      return -1;
+    }
 
     createScreen(&is->video_player, is->native_window, is->video_st->codec->width, is->video_st->codec->height);
 
     is->video_tid = malloc(sizeof(*(is->video_tid)));
 
     pthread_create(is->video_tid, NULL, (void *) &video_thread, is);
-    is->sws_ctx = createScaler(&is->video_player, is->video_st->codec);
+    /* otherwise created on the first decoded picture */
+    if (codecCtx->pix_fmt != AV_PIX_FMT_NONE) {
+      is->sws_ctx = createScaler(&is->video_player, is->video_st->codec);
+    }
 
     codecCtx->get_buffer2 = our_get_buffer;
 
@@ -859,18 +1472,296 @@ int stream_component_open(VideoState *is, int stream_index) {
   return 0;
 }
 
+/*
+ * The container header is enough to start when every audio and video
+ * stream has a codec and the parameters its output is created with; the
+ * decoders fill in the rest from the first frames.
+ */
+static int stream_params_complete(AVFormatContext *ic) {
+  unsigned int i;
+
+  /* streams may still be added while reading packets */
+  if (!ic->nb_streams || (ic->ctx_flags & AVFMTCTX_NOHEADER)) {
+    return 0;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVCodecParameters *par = ic->streams[i]->codecpar;
+
+    switch (par->codec_type) {
+    case AVMEDIA_TYPE_AUDIO:
+      if (par->codec_id == AV_CODEC_ID_NONE || par->sample_rate <= 0 || par->channels <= 0) {
+        return 0;
+      }
+      break;
+    case AVMEDIA_TYPE_VIDEO:
+      if (par->codec_id == AV_CODEC_ID_NONE || par->width <= 0 || par->height <= 0) {
+        return 0;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return 1;
+}
+
+/* The container duration is otherwise estimated by avformat_find_stream_info */
+static void stream_estimate_duration(AVFormatContext *ic) {
+  unsigned int i;
+
+  if (ic->duration != AV_NOPTS_VALUE) {
+    return;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    if (st->duration != AV_NOPTS_VALUE) {
+      ic->duration = FFMAX(ic->duration, av_rescale_q(st->duration, st->time_base, AV_TIME_BASE_Q));
+    }
+  }
+}
+
+/*
+ * Nested opens of demuxers like hls and dash. They copy the protocol options
+ * of the connection they were opened on, which they can't do with a custom
+ * pb, so hand the ones of io_context down the same way.
+ */
+static int stream_io_open(AVFormatContext *s, AVIOContext **pb, const char *url,
+                          int flags, AVDictionary **options) {
+  static const char *const names[] = { "user_agent", "cookies", "headers", "http_proxy" };
+  VideoState *is = s->opaque;
+  AVDictionary *tmp = NULL;
+  unsigned int i;
+  int ret;
+
+  if (!options) {
+    options = &tmp;
+  }
+  for (i = 0; i < FF_ARRAY_ELEMS(names); i++) {
+    uint8_t *value = NULL;
+    if (av_opt_get(is->io_context, names[i], AV_OPT_SEARCH_CHILDREN, &value) >= 0 && value && *value) {
+      av_dict_set(options, names[i], (char *) value, AV_DICT_DONT_STRDUP_VAL | AV_DICT_DONT_OVERWRITE);
+    } else {
+      av_free(value);
+    }
+  }
+
+  ret = is->io_open(s, pb, url, flags, options);
+  av_dict_free(&tmp);
+  return ret;
+}
+
+/* Opens the container on pb, probing the format unless fmt is given */
+static int stream_open_input(VideoState *is, AVIOContext *pb, AVIOInterruptCB *callback,
+                             AVInputFormat *fmt, AVDictionary **options) {
+  is->pFormatCtx = avformat_alloc_context();
+  if (!is->pFormatCtx) {
+    return AVERROR(ENOMEM);
+  }
+  is->pFormatCtx->pb = pb;
+  is->pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+  is->pFormatCtx->interrupt_callback = *callback;
+  if (pb == is->io_context) {
+    is->pFormatCtx->opaque = is;
+    is->io_open = is->pFormatCtx->io_open;
+    is->pFormatCtx->io_open = stream_io_open;
+  }
+
+  return avformat_open_input(&is->pFormatCtx, is->filename, fmt, options);
+}
+
+/* Milliseconds from the start of prepare to the stage completed at t */
+static int open_timing_ms(VideoState *is, int64_t t) {
+  if (!t || !is->open_timings.start) {
+    return -1;
+  }
+  return (int) ((t - is->open_timings.start) / 1000);
+}
+
+/*
+ * Sends MEDIA_PREPARED once the output can start: prepared_audio_ms of
+ * audio queued and the first picture decoded, for the streams the source
+ * has. Sent anyway once the queues are full or the source ended.
+ */
+static void stream_check_prepared(VideoState *is, int eof) {
+  int ready;
+
+  if (is->prepared) {
+    return;
+  }
+
+  ready = eof || stream_queues_full(is) ||
+          ((is->audioStream < 0 ||
+            packet_queue_duration_ms(&is->audioq) >= FFMIN(is->prepared_audio_ms, is->buffer_max_ms)) &&
+           (is->videoStream < 0 || !is->prepared_video_frame ||
+            (SDL_AtomicGet(&is->decoded_types) & (1 << AVMEDIA_TYPE_VIDEO))));
+  if (!ready) {
+    return;
+  }
+
+  is->open_timings.prepared = av_gettime();
+  fprintf(stderr, "Prepared %s: io %d ms, input %d ms, stream info %d ms, first packet %d ms, "
+          "first frame %d ms, prepared %d ms\n", is->filename,
+          open_timing_ms(is, is->open_timings.io_open),
+          open_timing_ms(is, is->open_timings.input_open),
+          open_timing_ms(is, is->open_timings.stream_info),
+          open_timing_ms(is, is->open_timings.first_packet),
+          open_timing_ms(is, is->open_timings.first_frame),
+          open_timing_ms(is, is->open_timings.prepared));
+
+  is->prepared = 1;
+  stream_prepare_done(is, NO_ERROR);
+  notify_from_thread(is, MEDIA_PREPARED, 0, 0);
+}
+
+/*
+ * The timestamps avformat_seek_file may land on for the seek mode. A
+ * SEEK_CLOSEST starts from the keyframe before the target and the decoders
+ * drop what precedes it. SEEK_CLOSEST_SYNC picks the nearer keyframe from
+ * the demuxer index if it has one, else leaves the choice to the demuxer.
+ */
+static void stream_seek_range(VideoState *is, int mode, int64_t *target, int64_t *min, int64_t *max) {
+  AVStream *st = is->video_st ? is->video_st : is->audio_st;
+  int64_t ts;
+  int prev, next;
+
+  switch (mode) {
+  case SEEK_NEXT_SYNC:
+    *min = *target;
+    *max = INT64_MAX;
+    break;
+  case SEEK_CLOSEST_SYNC:
+    *min = INT64_MIN;
+    *max = INT64_MAX;
+    if (!st) {
+      break;
+    }
+    ts = av_rescale_q(*target, AV_TIME_BASE_Q, st->time_base);
+    prev = av_index_search_timestamp(st, ts, AVSEEK_FLAG_BACKWARD);
+    next = av_index_search_timestamp(st, ts, 0);
+    if (prev >= 0 && next >= 0) {
+      if (st->index_entries[next].timestamp - ts < ts - st->index_entries[prev].timestamp) {
+        prev = next;
+      }
+      /* rounded up, the keyframe is the last one at or before the target */
+      *target = av_rescale_q_rnd(st->index_entries[prev].timestamp, st->time_base,
+                                 AV_TIME_BASE_Q, AV_ROUND_UP);
+      *max = *target;
+    }
+    break;
+  default:
+    *min = INT64_MIN;
+    *max = *target;
+    break;
+  }
+}
+
+/*
+ * Seeks through the keyframe index of the stream feeding the output if the
+ * demuxer has no index of its own, e.g. MPEG-TS or raw ADTS and MP3. A
+ * demuxer with a generic index gets the entry added to it, its generic
+ * seek then jumps to the byte position and restarts the timestamps from
+ * the entry; any other is repositioned by byte and reads the timestamps
+ * from the packets. Returns -1 if the target is not indexed.
+ */
+static int stream_seek_indexed(VideoState *is, int64_t target) {
+  AVFormatContext *ic = is->pFormatCtx;
+  AVInputFormat *fmt = ic->iformat;
+  AVStream *st = is->video_st ? is->video_st : is->audio_st;
+  SeekIndexEntry entry;
+
+  if (!is->seek_index_enabled || !st || (fmt->flags & AVFMT_NO_BYTE_SEEK) ||
+      ((fmt->read_seek || fmt->read_seek2) && !(fmt->flags & AVFMT_GENERIC_INDEX))) {
+    return -1;
+  }
+
+  if (seek_index_lookup(&is->seek_index[st->codecpar->codec_type],
+                        av_rescale_q(target, AV_TIME_BASE_Q, st->time_base), &entry) < 0) {
+    return -1;
+  }
+
+  if (fmt->flags & AVFMT_GENERIC_INDEX) {
+    if (av_add_index_entry(st, entry.pos, entry.pts, 0, 0, AVINDEX_KEYFRAME) < 0) {
+      return -1;
+    }
+    return avformat_seek_file(ic, st->index, INT64_MIN, entry.pts, entry.pts, 0);
+  }
+  return avformat_seek_file(ic, -1, INT64_MIN, entry.pos, entry.pos, AVSEEK_FLAG_BYTE);
+}
+
+/*
+ * Applies a change of KEY_PARAMETER_SCRUB. While the seek bar is dragged
+ * the audio stream is discarded by the demuxer and the video decoder only
+ * decodes keyframes; each seek shows the keyframe closest to its target
+ * and the demuxer stops reading until the next one. On release the player
+ * seeks to the last target with the mode of the last seekTo to refill the
+ * audio and reference frames, unless a seekTo is already pending.
+ */
+static void stream_update_scrub(VideoState *is, int64_t *scrub_pos) {
+  int scrubbing = is->scrub && is->video_st;
+
+  if (scrubbing == is->scrubbing) {
+    return;
+  }
+
+  if (scrubbing) {
+    *scrub_pos = (int64_t) (is->video_current_pts * AV_TIME_BASE);
+    /* keep the picture shown until the first seek */
+    is->scrub_serial = packet_queue_serial(&is->videoq);
+    if (is->audio_st) {
+      is->audio_st->discard = AVDISCARD_ALL;
+      packet_queue_flush(&is->audioq);
+      pcm_ring_wake(&is->audio_ring);
+    }
+    is->scrubbing = 1;
+    return;
+  }
+
+  is->scrubbing = 0;
+  if (is->audio_st) {
+    is->audio_st->discard = AVDISCARD_DEFAULT;
+  }
+
+  SDL_LockMutex(is->continue_read_mutex);
+  if (!is->seek_req) {
+    is->seek_pos = *scrub_pos;
+    is->seek_rel = 0;
+    is->seek_flags &= ~AVSEEK_FLAG_BYTE;
+    is->seek_generation++;
+    is->seek_internal = is->seek_generation;
+    is->seek_req = 1;
+  }
+  SDL_UnlockMutex(is->continue_read_mutex);
+}
+
+/* Local files are read through fd_io instead of the file protocol */
+static const char *local_file_path(const char *url) {
+  const char *path;
+
+  if (av_strstart(url, "file:", &path)) {
+    return path;
+  }
+  return url[0] == '/' ? url : NULL;
+}
+
 int decode_interrupt_cb(void *opaque) {
   VideoState *is = (VideoState *)opaque;
 
-  return (is && is->quit);
+  /* a newer seekTo makes the running seek pointless */
+  return (is && (is->quit ||
+                 (is->seek_running >= 0 && is->seek_running != is->seek_generation)));
 }
 int decode_thread(void *arg) {
 
   VideoState *is = (VideoState *)arg;
   AVPacket pkt1, *packet = &pkt1;
 
-  AVDictionary *io_dict = NULL;
   AVIOInterruptCB callback;
+  AVIOContext *pb = NULL;
+  AVDictionary *retry_options = NULL;
+  ProbeCacheEntry *cache_entry = NULL;
+  int probed = 0;
 
   int video_index = -1;
   int audio_index = -1;
@@ -878,10 +1769,19 @@ int decode_thread(void *arg) {
 
   int ret;
   int eof = 0;
+  Uint32 retry_delay = READ_RETRY_MIN_DELAY;
+  AVStream *st;
+  int64_t buffered_until = 0, last_update = 0, scrub_pos = 0;
+  int last_percent = -1;
+  RenderClock render_clock;
 
   is->videoStream=-1;
   is->audioStream=-1;
 
+  memset(&is->open_timings, 0, sizeof(OpenTimings));
+  SDL_AtomicSet(&is->decoded_types, 0);
+  is->open_timings.start = av_gettime();
+
   AVDictionary *options = NULL;
   av_dict_set(&options, "icy", "1", 0);
   av_dict_set(&options, "user-agent", "FFmpegMediaPlayer", 0);
@@ -890,38 +1790,100 @@ int decode_thread(void *arg) {
     av_dict_set(&options, "headers", is->headers, 0);
   }
 
-  if (is->offset > 0) {
-    is->pFormatCtx = avformat_alloc_context();
-    is->pFormatCtx->skip_initial_bytes = is->offset;
-    //is->pFormatCtx->iformat = av_find_input_format("mp3");
+  if (is->fast_start) {
+    av_dict_set_int(&options, "probesize", is->probe_size, 0);
+    av_dict_set_int(&options, "analyzeduration", (int64_t) is->analyze_duration_ms * 1000, 0);
   }
 
   // will interrupt blocking functions if we quit!
   callback.callback = decode_interrupt_cb;
   callback.opaque = is;
-  if (avio_open2(&is->io_context, is->filename, 0, &callback, &io_dict))
-  {
+
+  if (is->fd == -1 && local_file_path(is->filename)) {
+    is->fd = open(local_file_path(is->filename), O_RDONLY | O_CLOEXEC);
+  }
+
+  if (is->fd != -1) {
+    // read the descriptor directly, limited to the offset/length window
+    is->fd_io = fd_io_open(is->fd, is->offset, is->length, is->mmap_io ? FD_IO_MMAP : 0);
+    pb = is->fd_io;
+  } else if (avio_open2(&is->io_context, is->filename, AVIO_FLAG_READ, &callback, &options) >= 0) {
+    /*
+     * Open the connection once with the headers and protocol options and
+     * hand it to the demuxer, which would otherwise connect a second time
+     * and download the head of the file again. avio_open2 removes the
+     * options it used, the rest are left for avformat_open_input; nested
+     * opens get them from the connection in stream_io_open.
+     */
+    pb = is->io_context;
+  }
+  if (!pb) {
     fprintf(stderr, "Unable to open I/O for %s\n", is->filename);
+    av_dict_free(&options);
     notify_from_thread(is, MEDIA_ERROR, 0, 0);
     return -1;
   }
+  is->open_timings.io_open = av_gettime();
+
+  is->probe_cache_hit = 0;
+  memset(is->probe_cache_check, 0, sizeof(is->probe_cache_check));
+  if (is->probe_cache_dir[0] &&
+      probe_cache_source_key(is->probe_cache_key, sizeof(is->probe_cache_key), is->filename,
+                             is->fd, is->offset, is->length, is->io_context ? avio_size(is->io_context) : -1) == 0) {
+    cache_entry = probe_cache_lookup(is->probe_cache_dir, is->probe_cache_key);
+  } else {
+    is->probe_cache_key[0] = '\0';
+  }
 
   // Open video file
-  if(avformat_open_input(&is->pFormatCtx, is->filename, NULL, &options)!=0)
+  if (cache_entry) {
+    av_dict_copy(&retry_options, options, 0);
+    ret = stream_open_input(is, pb, &callback, av_find_input_format(cache_entry->format_name), &options);
+    if (ret != 0) {
+      /* the source no longer matches its entry, probe it from the start */
+      probe_cache_remove(is->probe_cache_dir, is->probe_cache_key);
+      probe_cache_free(&cache_entry);
+      ret = avio_seek(pb, 0, SEEK_SET) < 0 ? ret : stream_open_input(is, pb, &callback, NULL, &retry_options);
+    }
+    av_dict_free(&retry_options);
+  } else {
+    ret = stream_open_input(is, pb, &callback, NULL, &options);
+  }
+  av_dict_free(&options);
+  if(ret != 0)
   {
 	  notify_from_thread(is, MEDIA_ERROR, 0, 0);
     return -1; // Couldn't open file
   }
+  is->open_timings.input_open = av_gettime();
+
+  if (cache_entry) {
+    if (probe_cache_apply(cache_entry, is->pFormatCtx) == 0) {
+      is->probe_cache_hit = 1;
+    } else {
+      probe_cache_remove(is->probe_cache_dir, is->probe_cache_key);
+    }
+    probe_cache_free(&cache_entry);
+  }
 
   // Retrieve stream information
-  if(avformat_find_stream_info(is->pFormatCtx, NULL)<0)
+  if (is->probe_cache_hit) {
+    stream_estimate_duration(is->pFormatCtx);
+  } else if (is->fast_start && stream_params_complete(is->pFormatCtx)) {
+    stream_estimate_duration(is->pFormatCtx);
+  } else if(avformat_find_stream_info(is->pFormatCtx, NULL)<0)
   {
 	  notify_from_thread(is, MEDIA_ERROR, 0, 0);
     return -1; // Couldn't find stream information
+  } else {
+    probed = 1;
   }
+  is->open_timings.stream_info = av_gettime();
 
   // Dump information about file onto standard error
-  av_dump_format(is->pFormatCtx, 0, is->filename, 0);
+  if (av_log_get_level() >= AV_LOG_DEBUG) {
+    av_dump_format(is->pFormatCtx, 0, is->filename, 0);
+  }
 
   // Find the first video stream
   for(i=0; i<is->pFormatCtx->nb_streams; i++) {
@@ -943,6 +1905,17 @@ int decode_thread(void *arg) {
     stream_component_open(is, video_index);
   }
 
+  if (is->seek_index_enabled) {
+    if (is->audioStream >= 0) {
+      seek_index_init(&is->seek_index[AVMEDIA_TYPE_AUDIO], is->audioStream, is->audio_st->time_base);
+    }
+    if (is->videoStream >= 0) {
+      seek_index_init(&is->seek_index[AVMEDIA_TYPE_VIDEO], is->videoStream, is->video_st->time_base);
+    }
+    probe_cache_load_seek_index(is->probe_cache_dir, is->probe_cache_key,
+                                is->seek_index, AVMEDIA_TYPE_NB);
+  }
+
   if(is->videoStream < 0 && is->audioStream < 0) {
   //if(is->videoStream < 0 || is->audioStream < 0) {
     fprintf(stderr, "%s: could not open codecs\n", is->filename);
@@ -956,6 +1929,13 @@ int decode_thread(void *arg) {
   set_chapter_count(is->pFormatCtx);
   //set_video_dimensions(is->pFormatCtx, is->video_st);
 
+  if (is->probe_cache_hit) {
+    is->probe_cache_check[AVMEDIA_TYPE_AUDIO] = is->audioStream >= 0;
+    is->probe_cache_check[AVMEDIA_TYPE_VIDEO] = is->videoStream >= 0;
+  } else if (probed && is->probe_cache_key[0]) {
+    probe_cache_store(is->probe_cache_dir, is->probe_cache_key, is->pFormatCtx, is->probe_cache_max_bytes);
+  }
+
   notify_from_thread(is, MEDIA_INFO, MEDIA_INFO_METADATA_UPDATE, 0);
 
   // main decode loop
@@ -973,60 +1953,153 @@ int decode_thread(void *arg) {
             av_read_play(is->pFormatCtx);
     }*/
 
+    stream_update_scrub(is, &scrub_pos);
+
     // seek stuff goes here
     if(is->seek_req) {
-		int64_t seek_target = is->seek_pos;
-		int64_t seek_min    = is->seek_rel > 0 ? seek_target - is->seek_rel + 2: INT64_MIN;
-		int64_t seek_max    = is->seek_rel < 0 ? seek_target - is->seek_rel - 2: INT64_MAX;
+		int64_t seek_pos, seek_target, seek_min, seek_max;
+		int seek_flags, seek_mode, generation, superseded, exact, internal;
+		int ret = 0;
+
+		/* take the latest request, seekTo may replace it while it runs */
+		SDL_LockMutex(is->continue_read_mutex);
+		seek_pos = is->seek_pos;
+		seek_flags = is->seek_flags;
+		seek_mode = is->seek_mode;
+		generation = is->seek_generation;
+		internal = generation == is->seek_internal;
+		is->seek_running = generation;
+		SDL_UnlockMutex(is->continue_read_mutex);
+
+		/* a preview only needs a keyframe near the target */
+		if (is->scrubbing) {
+		  seek_mode = SEEK_CLOSEST_SYNC;
+		  scrub_pos = seek_pos;
+		}
+		seek_target = seek_pos;
+		exact = seek_mode == SEEK_CLOSEST;
+		stream_seek_range(is, seek_mode, &seek_target, &seek_min, &seek_max);
+
+		/* the index only knows the keyframes before a target */
+		if ((seek_flags & AVSEEK_FLAG_BYTE) ||
+		    (seek_mode != SEEK_PREVIOUS_SYNC && !exact) ||
+		    stream_seek_indexed(is, seek_target) < 0) {
+		  ret = avformat_seek_file(is->pFormatCtx, -1, seek_min, seek_target, seek_max, seek_flags);
+		}
+		is->seek_running = -1;
+		is->nb_seeks++;
+
+		SDL_LockMutex(is->continue_read_mutex);
+		superseded = generation != is->seek_generation;
+		SDL_UnlockMutex(is->continue_read_mutex);
+		if (superseded) {
+		  /* maybe aborted by decode_interrupt_cb, which leaves the error on the context */
+		  if (is->pFormatCtx->pb) {
+		    is->pFormatCtx->pb->error = 0;
+		    is->pFormatCtx->pb->eof_reached = 0;
+		  }
+		  continue;
+		}
 
-		int ret = avformat_seek_file(is->pFormatCtx, -1, seek_min, seek_target, seek_max, is->seek_flags);
       if(ret < 0) {
 	fprintf(stderr, "%s: error while seeking\n", is->pFormatCtx->filename);
+	is->seek_start = 0;
       } else {
+	is->seek_exact_pts = (double) seek_pos / AV_TIME_BASE;
 	if(is->audioStream >= 0) {
 	  packet_queue_flush(&is->audioq);
-	  packet_queue_put(is, &is->audioq, &is->flush_pkt);
+	  is->audio_exact_serial = exact ? packet_queue_serial(&is->audioq) : -1;
+	  pcm_ring_wake(&is->audio_ring);
 	}
 	if(is->videoStream >= 0) {
 	  packet_queue_flush(&is->videoq);
-	  packet_queue_put(is, &is->videoq, &is->flush_pkt);
+	  is->video_exact_serial = exact ? packet_queue_serial(&is->videoq) : -1;
+	}
+	is->seek_output_serial = packet_queue_serial(is->audioStream >= 0 ? &is->audioq : &is->videoq);
+	if(!internal) {
+	  notify_from_thread(is, MEDIA_SEEK_COMPLETE, (int) (seek_pos / 1000), 0);
 	}
-	notify_from_thread(is, MEDIA_SEEK_COMPLETE, 0, 0);
 
       }
-      is->seek_req = 0;
+      /* a request that came in meanwhile is served on the next pass */
+      SDL_LockMutex(is->continue_read_mutex);
+      if (generation == is->seek_generation) {
+        is->seek_req = 0;
+      }
+      SDL_UnlockMutex(is->continue_read_mutex);
       eof = 0;
+      is->eof = 0;
+      is->completed = 0;
+      last_percent = -1;
     }
 
-    if (is->audioq.size >= MAX_AUDIOQ_SIZE && !is->prepared) {
-        queueAudioSamples(&is->audio_player, is);
+    stream_check_prepared(is, 0);
 
-        notify_from_thread(is, MEDIA_PREPARED, 0, 0);
-    	is->prepared = 1;
-    }
+    stream_check_buffering(is);
 
-    if(is->audioq.size > MAX_AUDIOQ_SIZE ||
-       is->videoq.size > MAX_VIDEOQ_SIZE) {
-      SDL_Delay(10);
+    if(stream_queues_full(is)) {
+      stream_wait_read(is, 0);
       continue;
     }
-    if((ret = av_read_frame(is->pFormatCtx, packet)) < 0) {
+    if (is->offline_render) {
+      render_clock_start(&render_clock);
+    }
+    ret = av_read_frame(is->pFormatCtx, packet);
+    if (is->offline_render) {
+      render_stage_add(&is->render_stages[RENDER_STAGE_DEMUX], &render_clock, ret >= 0);
+    }
+    if(ret < 0) {
+      /* the seek bar may still be dragged back */
+      if (is->scrubbing && (ret == AVERROR_EOF || is->pFormatCtx->pb->eof_reached)) {
+        stream_wait_read(is, READ_RETRY_MAX_DELAY);
+        continue;
+      }
       if (ret == AVERROR_EOF || !is->pFormatCtx->pb->eof_reached) {
           eof = 1;
+          is->eof = 1;
     	  break;
       }
 
       if(is->pFormatCtx->pb->error == 0) {
-	SDL_Delay(100); /* no error; wait for user input */
+	/* no error; wait for more data, a seek or quit */
+	stream_wait_read(is, retry_delay);
+	retry_delay = FFMIN(retry_delay * 2, READ_RETRY_MAX_DELAY);
 	continue;
       } else {
 	break;
       }
     }
+    retry_delay = READ_RETRY_MIN_DELAY;
+
+    if (!is->open_timings.first_packet) {
+      is->open_timings.first_packet = av_gettime();
+    }
+
+    st = is->pFormatCtx->streams[packet->stream_index];
+    if(packet->stream_index == is->videoStream || packet->stream_index == is->audioStream) {
+      stream_packet_duration(st, packet);
+      if (is->seek_index_enabled && (packet->flags & AV_PKT_FLAG_KEY)) {
+        seek_index_add(&is->seek_index[st->codecpar->codec_type],
+                       packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts, packet->pos);
+      }
+    }
+
+    /* track how far the stream feeding the output has been read */
+    if(st == (is->audioStream >= 0 ? is->audio_st : is->video_st)) {
+      int64_t ts = packet->pts != AV_NOPTS_VALUE ? packet->pts : packet->dts;
+      if (ts != AV_NOPTS_VALUE) {
+        buffered_until = av_rescale_q(ts + packet->duration, st->time_base, AV_TIME_BASE_Q);
+        if (is->pFormatCtx->start_time != AV_NOPTS_VALUE) {
+          buffered_until -= is->pFormatCtx->start_time;
+        }
+        stream_buffering_update(is, buffered_until, &last_percent, &last_update);
+      }
+    }
+
     // Is this a packet from the video stream?
     if(packet->stream_index == is->videoStream) {
       packet_queue_put(is, &is->videoq, packet);
-    } else if(packet->stream_index == is->audioStream) {
+    } else if(packet->stream_index == is->audioStream && !is->scrubbing) {
       packet_queue_put(is, &is->audioq, packet);
     } else {
       av_packet_unref(packet);
@@ -1038,21 +2111,54 @@ int decode_thread(void *arg) {
   }
 
   if (eof) {
-	  notify_from_thread(is, MEDIA_PLAYBACK_COMPLETE, 0, 0);
+    /* the whole source is shorter than the prepare threshold */
+    stream_check_prepared(is, 1);
+    stream_check_buffering(is);
+    stream_buffering_update(is, is->pFormatCtx->duration, &last_percent, &last_update);
   }
 
+  /*
+   * with audio the output reports the end once it played the last samples,
+   * an offline render once it delivered the last picture
+   */
+  if (eof && is->audioStream < 0 && !is->offline_render) {
+    stream_playback_complete(is, NULL, 0);
+  }
+
+  if (is->seek_index[AVMEDIA_TYPE_AUDIO].dirty || is->seek_index[AVMEDIA_TYPE_VIDEO].dirty) {
+    probe_cache_store_seek_index(is->probe_cache_dir, is->probe_cache_key,
+                                 is->seek_index, AVMEDIA_TYPE_NB, is->probe_cache_max_bytes);
+  }
+
+  /* stopped or failed to read before the source was prepared */
+  stream_prepare_done(is, UNKNOWN_ERROR);
+
   one = 1;
   return 0;
 }
 
-void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes) {
-	if (!is->seek_req) {
-		is->seek_pos = pos;
-		is->seek_rel = rel;
-		is->seek_flags &= ~AVSEEK_FLAG_BYTE;
-		if (seek_by_bytes)
-			is->seek_flags |= AVSEEK_FLAG_BYTE;
-		is->seek_req = 1;
+/*
+ * The latest request wins: it replaces one the demuxer has not taken yet,
+ * and a seek already running for an older target is aborted through
+ * decode_interrupt_cb, so only the last target sends MEDIA_SEEK_COMPLETE.
+ */
+void stream_seek(VideoState *is, int64_t pos, int64_t rel, int seek_by_bytes, int mode) {
+	if (is->continue_read_mutex) {
+		SDL_LockMutex(is->continue_read_mutex);
+	}
+	is->seek_pos = pos;
+	is->seek_rel = rel;
+	is->seek_mode = mode;
+	is->seek_output_serial = -1;
+	is->seek_start = av_gettime();
+	is->seek_flags &= ~AVSEEK_FLAG_BYTE;
+	if (seek_by_bytes)
+		is->seek_flags |= AVSEEK_FLAG_BYTE;
+	is->seek_generation++;
+	is->seek_req = 1;
+	if (is->continue_read_mutex) {
+		SDL_CondSignal(is->continue_read_cond);
+		SDL_UnlockMutex(is->continue_read_mutex);
 	}
 }
 
@@ -1060,53 +2166,64 @@ VideoState * create() {
 	VideoState *is;
 
 	is = av_mallocz(sizeof(VideoState));
+	is->fd = -1;
 	is->last_paused = -1;
 	is->stream_type = 3;
+	is->buffer_min_ms = DEFAULT_BUFFER_MIN_MS;
+	is->buffer_max_ms = DEFAULT_BUFFER_MAX_MS;
+	is->buffer_max_bytes = DEFAULT_BUFFER_MAX_BYTES;
+	is->buffering_low_ms = DEFAULT_BUFFERING_LOW_MS;
+	is->buffering_high_ms = DEFAULT_BUFFERING_HIGH_MS;
+	is->probe_size = DEFAULT_FAST_START_PROBE_SIZE;
+	is->analyze_duration_ms = DEFAULT_FAST_START_ANALYZE_MS;
+	is->probe_cache_max_bytes = PROBE_CACHE_DEFAULT_MAX_BYTES;
+	is->prepared_audio_ms = DEFAULT_PREPARED_AUDIO_MS;
+	is->prepared_video_frame = 1;
+	is->seek_index_enabled = 1;
+	is->audio_exact_serial = -1;
+	is->video_exact_serial = -1;
+	is->seek_running = -1;
+	is->scrub_serial = -1;
+	is->audio_buffer_count = AUDIO_BUFFERS_LOW_POWER_COUNT;
+	is->audio_buffer_ms = AUDIO_BUFFERS_LOW_POWER_MS;
+	is->audio_sink_type = AUDIO_SINK_OPENSL;
+	is->audio_resampler_quality = RESAMPLER_QUALITY_DEFAULT;
 
     return is;
 }
 
 VideoState * getNextMediaPlayer(VideoState **ps) {
-	/*VideoState *is = *ps;
-    
-    if (is && is->next) {
-        return is->next;
-    }*/
-    
-    return NULL;
+	VideoState *is = *ps;
+	VideoState *next = NULL;
+
+	if (is) {
+		pthread_mutex_lock(&next_player_lock);
+		next = is->next;
+		pthread_mutex_unlock(&next_player_lock);
+	}
+
+	return next;
 }
 
 void disconnect(VideoState **ps) {
 	VideoState *is = *ps;
+	int i;
 
 	if (is) {
 		if (is->pFormatCtx) {
 			avformat_close_input(&is->pFormatCtx);
-			is->pFormatCtx = NULL;
-		}
-
-		if (is->audioq.initialized == 1) {
-			if (is->audioq.first_pkt) {
-				free(is->audioq.first_pkt);
-			}
-
-			if (is->audioq.last_pkt) {
-				//free(is->audioq.last_pkt);
-			}
-
-			if (is->audioq.mutex) {
-				free(is->audioq.mutex);
-				is->audioq.mutex = NULL;
-			}
+			is->pFormatCtx = NULL;
+		}
 
-			if (is->audioq.cond) {
-				free(is->audioq.cond);
-				is->audioq.cond = NULL;
-			}
+		fd_io_close(&is->fd_io);
 
-			is->audioq.initialized = 0;
+		for (i = 0; i < AVMEDIA_TYPE_NB; i++) {
+			seek_index_free(&is->seek_index[i]);
 		}
 
+		packet_queue_destroy(&is->audioq);
+		pcm_ring_destroy(&is->audio_ring);
+
 		/*AVFrame *frame = &is->audio_frame;
 		    if (frame->data) {
 		    	av_free_frame(frame);
@@ -1117,27 +2234,7 @@ void disconnect(VideoState **ps) {
 			av_packet_unref(pkt);
 		}
 
-		if (is->videoq.initialized == 1) {
-			if (is->videoq.first_pkt) {
-				free(is->videoq.first_pkt);
-			}
-
-			if (is->videoq.last_pkt) {
-				//free(is->videoq.last_pkt);
-			}
-
-			if (is->videoq.mutex) {
-				free(is->videoq.mutex);
-				is->videoq.mutex = NULL;
-			}
-
-			if (is->videoq.cond) {
-				free(is->videoq.cond);
-				is->videoq.cond = NULL;
-			}
-
-			is->videoq.initialized = 0;
-		}
+		packet_queue_destroy(&is->videoq);
 
 		//VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
 
@@ -1151,6 +2248,26 @@ void disconnect(VideoState **ps) {
 			is->pictq_cond = NULL;
 		}
 
+		if (is->continue_read_cond) {
+			SDL_DestroyCond(is->continue_read_cond);
+			is->continue_read_cond = NULL;
+		}
+
+		if (is->continue_read_mutex) {
+			SDL_DestroyMutex(is->continue_read_mutex);
+			is->continue_read_mutex = NULL;
+		}
+
+		if (is->prepare_cond) {
+			SDL_DestroyCond(is->prepare_cond);
+			is->prepare_cond = NULL;
+		}
+
+		if (is->prepare_mutex) {
+			SDL_DestroyMutex(is->prepare_mutex);
+			is->prepare_mutex = NULL;
+		}
+
 		if (is->parse_tid) {
 			free(is->parse_tid);
 			is->parse_tid = NULL;
@@ -1161,6 +2278,11 @@ void disconnect(VideoState **ps) {
 			is->video_tid = NULL;
 		}
 
+		if (is->audio_tid) {
+			free(is->audio_tid);
+			is->audio_tid = NULL;
+		}
+
 		if (is->io_context) {
 			avio_close(is->io_context);
 			is->io_context = NULL;
@@ -1176,17 +2298,18 @@ void disconnect(VideoState **ps) {
 			is->sws_ctx_audio = NULL;
 		}
 
-		if (is->audio_player) {
-			shutdown(&is->audio_player);
-			is->audio_player = NULL;
-		}
+		audio_sink_free(&is->audio_sink);
 
 		if (is->tid) {
 			free(is->tid);
 			is->tid = NULL;
 		}
 
-	    av_packet_unref(&is->flush_pkt);
+		/* the descriptor is kept across stop() so the source can be prepared again */
+		if (is->fd != -1) {
+			close(is->fd);
+			is->fd = -1;
+		}
 
 		av_freep(&is);
 		*ps = NULL;
@@ -1226,12 +2349,17 @@ int setDataSourceFD(VideoState **ps, int fd, int64_t offset, int64_t length) {
 
 	int myfd = dup(fd);
 
+	if (myfd < 0) {
+		return UNKNOWN_ERROR;
+	}
+
 	char str[20];
-	sprintf(str, "pipe:%d", myfd);
+	sprintf(str, "fd:%d", myfd);
 	strncpy(is->filename, str, sizeof(is->filename));
 
 	is->fd = myfd;
 	is->offset = offset;
+	is->length = length;
 
 	*ps = is;
 
@@ -1272,35 +2400,61 @@ int prepare(VideoState **ps) {
 	is->prepare_sync = 1;
 	int ret = prepareAsync_l(ps);
 	if (ret != NO_ERROR) {
-		return ret;
-	}
-	if (is->prepare_sync) {
-		while (!is->prepared) {
-			sleep(1);
-		}
-
 		is->prepare_sync = 0;
+		return ret;
 	}
-	return is->prepare_sync;
+	ret = stream_wait_prepared(is, is->prepare_timeout_ms);
+	is->prepare_sync = 0;
+	return ret;
 }
 
 int prepareAsync(VideoState **ps) {
   return prepareAsync_l(ps);
 }
 
-int start(VideoState **ps) {
-	VideoState *is = *ps;
+static int start_l(VideoState *is) {
+	if (is && is->offline_render && !is->render_start) {
+		is->render_start = av_gettime_relative();
+	}
 
-	if (is && is->audio_player) {
+	if (is && is->audio_sink) {
 		is->paused = 0;
 	    is->player_started = 1;
-		setPlayingAudioPlayer(&is->audio_player, 0);
+	    /* the sink keeps pulling samples from here on */
+		audio_sink_start(is->audio_sink);
+		return NO_ERROR;
+	}
+
+	/* video only, the refresh thread waits for player_started */
+	if (is && is->video_st) {
+		is->paused = 0;
+		is->player_started = 1;
 		return NO_ERROR;
 	}
 
 	return INVALID_OPERATION;
 }
 
+int start(VideoState **ps) {
+	int ret;
+
+	/* not while the previous player hands its audio sink over */
+	pthread_mutex_lock(&next_player_lock);
+	ret = start_l(*ps);
+	pthread_mutex_unlock(&next_player_lock);
+	return ret;
+}
+
+int startAsNext(VideoState **ps) {
+	VideoState *is = *ps;
+	int ret;
+
+	pthread_mutex_lock(&next_player_lock);
+	ret = is && is->player_started ? ALREADY_EXISTS : start_l(is);
+	pthread_mutex_unlock(&next_player_lock);
+	return ret;
+}
+
 int stop(VideoState **ps) {
 	VideoState *is = *ps;
 
@@ -1311,13 +2465,13 @@ int stop(VideoState **ps) {
 	     * audio queues are waiting for more data.  Make them stop
 	     * waiting and terminate normally.
 	     */
-	    if (is->audioq.initialized == 1) {
-	    	SDL_CondSignal(is->audioq.cond);
-	    }
+	    packet_queue_wake(&is->audioq);
 
-	    if (is->videoq.initialized == 1) {
-	    	SDL_CondSignal(is->videoq.cond);
-	    }
+	    pcm_ring_wake(&is->audio_ring);
+
+	    packet_queue_wake(&is->videoq);
+
+	    stream_wake_read(is);
 
 	    if (is->video_refresh_tid) {
 	    	pthread_join(*(is->video_refresh_tid), NULL);
@@ -1328,14 +2482,20 @@ int stop(VideoState **ps) {
 	    	printf("one: %d:\n", one);
 	    }
 
+	    if (is->audio_tid) {
+	    	pthread_join(*(is->audio_tid), NULL);
+	    }
+
 	    if (is->video_tid) {
             SDL_CondSignal(is->pictq_cond);
 	    	pthread_join(*(is->video_tid), NULL);
 	    	printf("two: %d:\n", two);
 	    }
 
-        setPlayingAudioPlayer(&is->audio_player, 2);
-        
+	    if (is->audio_sink) {
+	    	audio_sink_stop(is->audio_sink);
+	    }
+
 	    clear_l(&is);
 
 		return NO_ERROR;
@@ -1347,9 +2507,14 @@ int stop(VideoState **ps) {
 int pause_l(VideoState **ps) {
 	VideoState *is = *ps;
 
-	if (is && is->audio_player) {
+	if (is && is->audio_sink) {
+		is->paused = !is->paused;
+		audio_sink_pause(is->audio_sink);
+		return NO_ERROR;
+	}
+
+	if (is && is->video_st) {
 		is->paused = !is->paused;
-		setPlayingAudioPlayer(&is->audio_player, 1);
 		return NO_ERROR;
 	}
 
@@ -1394,8 +2559,8 @@ int getVideoHeight(VideoState **ps, int *h) {
     return NO_ERROR;
 }
 
-int seekTo(VideoState **ps, int msec) {
-    int result = seekTo_l(ps, msec);
+int seekTo(VideoState **ps, int msec, int mode) {
+    int result = seekTo_l(ps, msec, mode);
 	return result;
 }
 
@@ -1403,7 +2568,15 @@ int getCurrentPosition(VideoState **ps, int *msec) {
 	VideoState *is = *ps;
 
 	if (is) {
-		*msec = is->audio_clock * 1000;
+		/* the audio clock stands still while the seek bar is dragged */
+		if (is->scrubbing) {
+			*msec = is->video_current_pts * 1000;
+		} else if (is->audio_st) {
+			/* the decoder runs ahead of the output */
+			*msec = get_audio_clock(is) * 1000;
+		} else {
+			*msec = is->audio_clock * 1000;
+		}
 		return NO_ERROR;
 	}
 
@@ -1424,13 +2597,13 @@ int reset(VideoState **ps) {
 	     * audio queues are waiting for more data.  Make them stop
 	     * waiting and terminate normally.
 	     */
-	    if (is->audioq.initialized == 1) {
-	    	SDL_CondSignal(is->audioq.cond);
-	    }
+	    packet_queue_wake(&is->audioq);
 
-	    if (is->videoq.initialized == 1) {
-	    	SDL_CondSignal(is->videoq.cond);
-	    }
+	    pcm_ring_wake(&is->audio_ring);
+
+	    packet_queue_wake(&is->videoq);
+
+	    stream_wake_read(is);
 
 	    if (is->video_refresh_tid) {
 	    	pthread_join(*(is->video_refresh_tid), NULL);
@@ -1440,6 +2613,10 @@ int reset(VideoState **ps) {
 	    	pthread_join(*(is->parse_tid), NULL);
 	    }
 
+	    if (is->audio_tid) {
+	    	pthread_join(*(is->audio_tid), NULL);
+	    }
+
 	    if (is->video_tid) {
             SDL_CondSignal(is->pictq_cond);
 	    	pthread_join(*(is->video_tid), NULL);
@@ -1469,6 +2646,8 @@ int setLooping(VideoState **ps, int loop) {
 	VideoState *is = *ps;
 
 	if (is) {
+		/* a looping player never starts its next player */
+		is->loop = loop;
 		return NO_ERROR;
 	}
 
@@ -1488,8 +2667,8 @@ int isLooping(VideoState **ps) {
 int setVolume(VideoState **ps, float leftVolume, float rightVolume) {
 	VideoState *is = *ps;
 
-	if (is && is->audio_player) {
-		setVolumeUriAudioPlayer(&is->audio_player, leftVolume);
+	if (is && is->audio_sink) {
+		audio_sink_set_volume(is->audio_sink, leftVolume);
 		return NO_ERROR;
 	}
 
@@ -1526,22 +2705,400 @@ void notify_from_thread(VideoState *is, int msg, int ext1, int ext2) {
 	message->ext2 = ext2;
 	message->from_thread = 1;
 
+	/* an error before MEDIA_PREPARED fails a synchronous prepare */
+	if (msg == MEDIA_ERROR) {
+		stream_prepare_done(is, UNKNOWN_ERROR);
+	}
+
 	SDL_AddTimer(0, notify_from_thread_cb, message);
 }
 
 int setNextPlayer(VideoState **ps, VideoState *next) {
-    /*VideoState *is = *ps;
-    
-    if (is) {
-        is->next = next;
-        return NO_ERROR;
-    }*/
-    
-    return NO_ERROR; //INVALID_OPERATION;
+	VideoState *is = *ps;
+
+	if (is && next != is) {
+		/* once this returns the audio callback of is no longer uses the old next */
+		pthread_mutex_lock(&next_player_lock);
+		is->next = next;
+		pthread_mutex_unlock(&next_player_lock);
+		return NO_ERROR;
+	}
+
+	return INVALID_OPERATION;
+}
+
+int setParameter(VideoState **ps, int key, int value) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	switch (key) {
+	case KEY_PARAMETER_BUFFER_MIN_MS:
+		if (value < 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->buffer_min_ms = value;
+		break;
+	case KEY_PARAMETER_BUFFER_MAX_MS:
+		if (value <= 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->buffer_max_ms = value;
+		break;
+	case KEY_PARAMETER_BUFFER_MAX_BYTES:
+		if (value <= 0) {
+			return BAD_VALUE;
+		}
+		is->buffer_max_bytes = value;
+		break;
+	case KEY_PARAMETER_BUFFERING_LOW_MS:
+		if (value < 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->buffering_low_ms = value;
+		break;
+	case KEY_PARAMETER_BUFFERING_HIGH_MS:
+		if (value < 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->buffering_high_ms = value;
+		break;
+	case KEY_PARAMETER_MMAP_IO:
+		is->mmap_io = value != 0;
+		break;
+	case KEY_PARAMETER_FAST_START:
+		is->fast_start = value != 0;
+		break;
+	case KEY_PARAMETER_PROBE_SIZE:
+		/* the smallest probe libavformat accepts */
+		if (value < 32) {
+			return BAD_VALUE;
+		}
+		is->probe_size = value;
+		break;
+	case KEY_PARAMETER_ANALYZE_DURATION_MS:
+		if (value < 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->analyze_duration_ms = value;
+		break;
+	case KEY_PARAMETER_PROBE_CACHE_MAX_BYTES:
+		if (value <= 0) {
+			return BAD_VALUE;
+		}
+		is->probe_cache_max_bytes = value;
+		break;
+	case KEY_PARAMETER_PREPARED_AUDIO_MS:
+		if (value < 0 || value > MAX_BUFFER_MS) {
+			return BAD_VALUE;
+		}
+		is->prepared_audio_ms = value;
+		break;
+	case KEY_PARAMETER_PREPARED_VIDEO_FRAME:
+		is->prepared_video_frame = value != 0;
+		break;
+	case KEY_PARAMETER_PREPARE_TIMEOUT_MS:
+		if (value < 0) {
+			return BAD_VALUE;
+		}
+		is->prepare_timeout_ms = value;
+		break;
+	case KEY_PARAMETER_SEEK_INDEX:
+		is->seek_index_enabled = value != 0;
+		break;
+	case KEY_PARAMETER_SCRUB:
+		is->scrub = value != 0;
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFERS:
+		if (value == AUDIO_BUFFERS_LOW_POWER) {
+			is->audio_buffer_count = AUDIO_BUFFERS_LOW_POWER_COUNT;
+			is->audio_buffer_ms = AUDIO_BUFFERS_LOW_POWER_MS;
+		} else if (value == AUDIO_BUFFERS_LOW_LATENCY) {
+			is->audio_buffer_count = AUDIO_BUFFERS_LOW_LATENCY_COUNT;
+			is->audio_buffer_ms = AUDIO_BUFFERS_LOW_LATENCY_MS;
+		} else {
+			return BAD_VALUE;
+		}
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFER_COUNT:
+		if (value < 2 || value > AUDIO_BUFFERS_MAX_COUNT) {
+			return BAD_VALUE;
+		}
+		is->audio_buffer_count = value;
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFER_MS:
+		if (value <= 0 || value > AUDIO_BUFFERS_MAX_MS) {
+			return BAD_VALUE;
+		}
+		is->audio_buffer_ms = value;
+		break;
+	case KEY_PARAMETER_AUDIO_SINK:
+		if (value < AUDIO_SINK_OPENSL || value > AUDIO_SINK_WAV_UNTHROTTLED) {
+			return BAD_VALUE;
+		}
+		is->audio_sink_type = value;
+		break;
+	case KEY_PARAMETER_OFFLINE_RENDER:
+		is->offline_render = value != 0;
+		break;
+	case KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE:
+		if (value < 0 || value > AUDIO_OUTPUT_MAX_SAMPLE_RATE) {
+			return BAD_VALUE;
+		}
+		is->audio_output_sample_rate = value;
+		break;
+	case KEY_PARAMETER_AUDIO_OUTPUT_CHANNELS:
+		if (value < 0 || value > 2) {
+			return BAD_VALUE;
+		}
+		is->audio_output_channels = value;
+		break;
+	case KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY:
+		if (value < RESAMPLER_QUALITY_FAST || value > RESAMPLER_QUALITY_HIGH) {
+			return BAD_VALUE;
+		}
+		is->audio_resampler_quality = value;
+		break;
+	default:
+		/* the statistics keys are read only */
+		return BAD_VALUE;
+	}
+
+	/* let a parked demuxer pick up the new limits */
+	stream_wake_read(is);
+	return NO_ERROR;
+}
+
+int getParameter(VideoState **ps, int key, int *value) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	/* RENDER_STAT_NB keys per render_stage */
+	if (key >= KEY_PARAMETER_RENDER_DEMUX_MS && key <= KEY_PARAMETER_RENDER_VIDEO_CONVERT_FPS) {
+		key -= KEY_PARAMETER_RENDER_DEMUX_MS;
+		*value = render_stage_value(&is->render_stages[key / RENDER_STAT_NB], key % RENDER_STAT_NB);
+		return NO_ERROR;
+	}
+
+	switch (key) {
+	case KEY_PARAMETER_PACKET_POOL_ALLOCS:
+		*value = SDL_AtomicGet(&is->audioq.nb_allocs) + SDL_AtomicGet(&is->videoq.nb_allocs);
+		break;
+	case KEY_PARAMETER_PACKET_MOVES:
+		*value = SDL_AtomicGet(&is->audioq.nb_moved) + SDL_AtomicGet(&is->videoq.nb_moved);
+		break;
+	case KEY_PARAMETER_PACKET_COPIES:
+		*value = SDL_AtomicGet(&is->audioq.nb_copied) + SDL_AtomicGet(&is->videoq.nb_copied);
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFERED_MS:
+		*value = packet_queue_duration_ms(&is->audioq);
+		break;
+	case KEY_PARAMETER_VIDEO_BUFFERED_MS:
+		*value = packet_queue_duration_ms(&is->videoq);
+		break;
+	case KEY_PARAMETER_IO_OPEN_MS:
+		*value = open_timing_ms(is, is->open_timings.io_open);
+		break;
+	case KEY_PARAMETER_INPUT_OPEN_MS:
+		*value = open_timing_ms(is, is->open_timings.input_open);
+		break;
+	case KEY_PARAMETER_STREAM_INFO_MS:
+		*value = open_timing_ms(is, is->open_timings.stream_info);
+		break;
+	case KEY_PARAMETER_FIRST_PACKET_MS:
+		*value = open_timing_ms(is, is->open_timings.first_packet);
+		break;
+	case KEY_PARAMETER_PROBE_CACHE_HIT:
+		*value = is->probe_cache_hit;
+		break;
+	case KEY_PARAMETER_FIRST_FRAME_MS:
+		*value = open_timing_ms(is, is->open_timings.first_frame);
+		break;
+	case KEY_PARAMETER_PREPARED_MS:
+		*value = open_timing_ms(is, is->open_timings.prepared);
+		break;
+	case KEY_PARAMETER_SEEK_MS:
+		*value = is->seek_ms;
+		break;
+	case KEY_PARAMETER_SEEKS:
+		*value = is->nb_seeks;
+		break;
+	case KEY_PARAMETER_AUDIO_DECODED_MS:
+		*value = 0;
+		if (is->audio_st && is->audio_tgt_sample_rate > 0 && is->audio_tgt_channels > 0) {
+			*value = (int) (pcm_ring_fill(&is->audio_ring) * 1000LL /
+			                (is->audio_tgt_sample_rate * is->audio_tgt_channels * 2));
+		}
+		break;
+	case KEY_PARAMETER_AUDIO_UNDERRUNS:
+		*value = is->audio_underruns;
+		break;
+	case KEY_PARAMETER_AUDIO_PLAYED_MS:
+		*value = is->audio_sink ? (int) audio_sink_position(is->audio_sink) : 0;
+		break;
+	case KEY_PARAMETER_RENDER_MS:
+		*value = 0;
+		if (is->render_start) {
+			*value = (int) (((is->render_end ? is->render_end : av_gettime_relative()) - is->render_start) / 1000);
+		}
+		break;
+	case KEY_PARAMETER_BUFFER_MIN_MS:
+		*value = is->buffer_min_ms;
+		break;
+	case KEY_PARAMETER_BUFFER_MAX_MS:
+		*value = is->buffer_max_ms;
+		break;
+	case KEY_PARAMETER_BUFFER_MAX_BYTES:
+		*value = is->buffer_max_bytes;
+		break;
+	case KEY_PARAMETER_BUFFERING_LOW_MS:
+		*value = is->buffering_low_ms;
+		break;
+	case KEY_PARAMETER_BUFFERING_HIGH_MS:
+		*value = is->buffering_high_ms;
+		break;
+	case KEY_PARAMETER_MMAP_IO:
+		*value = is->mmap_io;
+		break;
+	case KEY_PARAMETER_FAST_START:
+		*value = is->fast_start;
+		break;
+	case KEY_PARAMETER_PROBE_SIZE:
+		*value = is->probe_size;
+		break;
+	case KEY_PARAMETER_ANALYZE_DURATION_MS:
+		*value = is->analyze_duration_ms;
+		break;
+	case KEY_PARAMETER_PROBE_CACHE_MAX_BYTES:
+		*value = is->probe_cache_max_bytes;
+		break;
+	case KEY_PARAMETER_PREPARED_AUDIO_MS:
+		*value = is->prepared_audio_ms;
+		break;
+	case KEY_PARAMETER_PREPARED_VIDEO_FRAME:
+		*value = is->prepared_video_frame;
+		break;
+	case KEY_PARAMETER_PREPARE_TIMEOUT_MS:
+		*value = is->prepare_timeout_ms;
+		break;
+	case KEY_PARAMETER_SEEK_INDEX:
+		*value = is->seek_index_enabled;
+		break;
+	case KEY_PARAMETER_SCRUB:
+		*value = is->scrub;
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFERS:
+		if (is->audio_buffer_count == AUDIO_BUFFERS_LOW_POWER_COUNT &&
+		    is->audio_buffer_ms == AUDIO_BUFFERS_LOW_POWER_MS) {
+			*value = AUDIO_BUFFERS_LOW_POWER;
+		} else if (is->audio_buffer_count == AUDIO_BUFFERS_LOW_LATENCY_COUNT &&
+		           is->audio_buffer_ms == AUDIO_BUFFERS_LOW_LATENCY_MS) {
+			*value = AUDIO_BUFFERS_LOW_LATENCY;
+		} else {
+			*value = -1;
+		}
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFER_COUNT:
+		*value = is->audio_buffer_count;
+		break;
+	case KEY_PARAMETER_AUDIO_BUFFER_MS:
+		*value = is->audio_buffer_ms;
+		break;
+	case KEY_PARAMETER_AUDIO_SINK:
+		*value = is->audio_sink_type;
+		break;
+	case KEY_PARAMETER_OFFLINE_RENDER:
+		*value = is->offline_render;
+		break;
+	case KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE:
+		*value = is->audio_output_sample_rate;
+		break;
+	case KEY_PARAMETER_AUDIO_OUTPUT_CHANNELS:
+		*value = is->audio_output_channels;
+		break;
+	case KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY:
+		*value = is->audio_resampler_quality;
+		break;
+	default:
+		return BAD_VALUE;
+	}
+
+	return NO_ERROR;
+}
+
+int setStringParameter(VideoState **ps, int key, const char *value) {
+	VideoState *is = *ps;
+
+	if (!is || !value) {
+		return INVALID_OPERATION;
+	}
+
+	switch (key) {
+	case KEY_PARAMETER_PROBE_CACHE_DIR:
+		if (strlen(value) >= sizeof(is->probe_cache_dir)) {
+			return BAD_VALUE;
+		}
+		av_strlcpy(is->probe_cache_dir, value, sizeof(is->probe_cache_dir));
+		break;
+	case KEY_PARAMETER_AUDIO_SINK_PATH:
+		if (strlen(value) >= sizeof(is->audio_sink_path)) {
+			return BAD_VALUE;
+		}
+		av_strlcpy(is->audio_sink_path, value, sizeof(is->audio_sink_path));
+		break;
+	default:
+		return BAD_VALUE;
+	}
+
+	return NO_ERROR;
+}
+
+/*
+ * Receivers of the output of offline render mode, called on the audio sink
+ * and refresh threads. Either may be NULL to drop that output.
+ */
+int setRenderCallbacks(VideoState **ps, void *opaque, render_audio_callback audio,
+                       render_video_callback video) {
+	VideoState *is = *ps;
+
+	if (!is) {
+		return INVALID_OPERATION;
+	}
+
+	is->render_opaque = opaque;
+	is->render_audio = audio;
+	is->render_video = video;
+	return NO_ERROR;
+}
+
+/*
+ * Hand the packet queue storage of a player that has been reset over to the
+ * player replacing it, so a new data source does not allocate it again.
+ */
+void recyclePacketQueues(VideoState **ps, VideoState **from) {
+	VideoState *is = *ps;
+	VideoState *old = *from;
+
+	if (!is || !old || is->audioq.pkts || is->videoq.pkts) {
+		return;
+	}
+
+	packet_queue_clear(&old->audioq);
+	packet_queue_clear(&old->videoq);
+	is->audioq = old->audioq;
+	is->videoq = old->videoq;
+	memset(&old->audioq, 0, sizeof(PacketQueue));
+	memset(&old->videoq, 0, sizeof(PacketQueue));
 }
 
 void clear_l(VideoState **ps) {
 	VideoState *is = *ps;
+	int i;
 
 	if (is) {
 		if (is->pFormatCtx) {
@@ -1549,6 +3106,8 @@ void clear_l(VideoState **ps) {
 			is->pFormatCtx = NULL;
 		}
 
+		fd_io_close(&is->fd_io);
+
 		is->videoStream = 0;
 		is->audioStream = 0;
 
@@ -1557,33 +3116,20 @@ void clear_l(VideoState **ps) {
 		is->external_clock_time = 0;
 	    is->seek_req = 0;
 	    is->seek_flags = 0;
+	    is->seek_mode = SEEK_PREVIOUS_SYNC;
 	    is->seek_pos = 0;
 	    is->seek_rel = 0;
+	    is->audio_exact_serial = -1;
+	    is->video_exact_serial = -1;
+	    is->seek_start = 0;
+	    is->seek_running = -1;
 
 	    is->audio_clock = 0;
 	    is->audio_st = NULL;
 
-	    if (is->audioq.initialized == 1) {
-	    	if (is->audioq.first_pkt) {
-	    		free(is->audioq.first_pkt);
-	    	}
-
-	        if (is->audioq.last_pkt) {
-	        	//free(is->audioq.last_pkt);
-			}
-
-	        if (is->audioq.mutex) {
-	        	free(is->audioq.mutex);
-	        	is->audioq.mutex = NULL;
-	        }
-
-	        if (is->audioq.cond) {
-	        	free(is->audioq.cond);
-	        	is->audioq.cond = NULL;
-	        }
-
-	        is->audioq.initialized = 0;
-	    }
+	    packet_queue_clear(&is->audioq);
+	    pcm_ring_clear(&is->audio_ring);
+	    is->audio_underruns = 0;
 
   	    /*AVFrame *frame = &is->audio_frame;
 	    if (frame->data) {
@@ -1614,27 +3160,7 @@ void clear_l(VideoState **ps) {
 	    is->video_current_pts_time = 0;
 	    is->video_st = NULL;
 
-	    if (is->videoq.initialized == 1) {
-	    	if (is->videoq.first_pkt) {
-	    		free(is->videoq.first_pkt);
-	    	}
-
-	        if (is->videoq.last_pkt) {
-	        	//free(is->videoq.last_pkt);
-			}
-
-	        if (is->videoq.mutex) {
-	        	free(is->videoq.mutex);
-	        	is->videoq.mutex = NULL;
-	        }
-
-	        if (is->videoq.cond) {
-	        	free(is->videoq.cond);
-	        	is->videoq.cond = NULL;
-	        }
-
-	        is->videoq.initialized = 0;
-	    }
+	    packet_queue_clear(&is->videoq);
 
 	    //VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
 	    is->pictq_size = 0;
@@ -1651,6 +3177,36 @@ void clear_l(VideoState **ps) {
 	    	is->pictq_cond = NULL;
 	    }
 
+	    if (is->continue_read_cond) {
+	    	SDL_DestroyCond(is->continue_read_cond);
+	    	is->continue_read_cond = NULL;
+	    }
+
+	    if (is->continue_read_mutex) {
+	    	SDL_DestroyMutex(is->continue_read_mutex);
+	    	is->continue_read_mutex = NULL;
+	    }
+
+	    if (is->prepare_cond) {
+	    	SDL_DestroyCond(is->prepare_cond);
+	    	is->prepare_cond = NULL;
+	    }
+
+	    if (is->prepare_mutex) {
+	    	SDL_DestroyMutex(is->prepare_mutex);
+	    	is->prepare_mutex = NULL;
+	    }
+	    is->prepare_done = 0;
+	    SDL_AtomicSet(&is->read_waiting, 0);
+	    SDL_AtomicSet(&is->buffering, 0);
+	    SDL_AtomicSet(&is->decoded_types, 0);
+	    is->buffering_start = 0;
+	    is->eof = 0;
+
+	    memset(is->render_stages, 0, sizeof(is->render_stages));
+	    is->render_start = 0;
+	    is->render_end = 0;
+
 	    if (is->video_refresh_tid) {
 	    	free(is->video_refresh_tid);
 	    	is->video_refresh_tid = NULL;
@@ -1666,6 +3222,11 @@ void clear_l(VideoState **ps) {
 	    	is->video_tid = NULL;
 	    }
 
+	    if (is->audio_tid) {
+	    	free(is->audio_tid);
+	    	is->audio_tid = NULL;
+	    }
+
 	    //is->filename[0] = '\0';
 	    //is->quit = 0;
 
@@ -1684,23 +3245,18 @@ void clear_l(VideoState **ps) {
 	    	is->sws_ctx_audio = NULL;
 	    }
 
-	    if (is->audio_player) {
-	    	shutdown(&is->audio_player);
-	    	is->audio_player = NULL;
-	    }
+	    audio_sink_free(&is->audio_sink);
 
 	    //is->audio_callback = NULL;
+	    for (i = 0; i < AVMEDIA_TYPE_NB; i++) {
+	    	seek_index_free(&is->seek_index[i]);
+	    }
+
 	    is->prepared = 0;
+	    is->completed = 0;
 
 	    //is->headers[0] = '\0';
 
-	    if (is->fd != -1) {
-		    close(is->fd);
-        }
-
-	    is->fd = -1;
-	    is->offset = 0;
-
 	    is->prepare_sync = 0;
 
 	    //is->notify_callback = NULL;
@@ -1712,15 +3268,22 @@ void clear_l(VideoState **ps) {
 	    is->last_paused = -1;
 	    is->player_started = 0;
 
-	    av_packet_unref(&is->flush_pkt);
+	    is->audio_pkt_serial = 0;
+	    is->audio_clock_serial = 0;
+	    is->video_pkt_serial = 0;
+	    is->video_clock_serial = 0;
 	}
 }
 
-int seekTo_l(VideoState **ps, int msec) {
+int seekTo_l(VideoState **ps, int msec, int mode) {
 	VideoState *is = *ps;
 
+	if (mode < SEEK_PREVIOUS_SYNC || mode > SEEK_CLOSEST) {
+		return BAD_VALUE;
+	}
+
 	if (is) {
-		stream_seek(is, msec * 1000, msec * 1000, 0);
+		stream_seek(is, msec * 1000LL, msec * 1000LL, 0, mode);
 		return NO_ERROR;
 	}
 
@@ -1734,6 +3297,14 @@ int prepareAsync_l(VideoState **ps) {
     	is->pictq_mutex = SDL_CreateMutex();
         is->pictq_cond = SDL_CreateCond();
 
+        is->continue_read_mutex = SDL_CreateMutex();
+        is->continue_read_cond = SDL_CreateCond();
+
+        is->prepare_mutex = SDL_CreateMutex();
+        is->prepare_cond = SDL_CreateCond();
+        is->prepare_done = 0;
+        is->prepare_status = NO_ERROR;
+
     	is->video_refresh_tid = malloc(sizeof(*(is->video_refresh_tid)));
     	pthread_create(is->video_refresh_tid, NULL, (void *) &video_refresh_timer, is);
 
@@ -1749,9 +3320,6 @@ int prepareAsync_l(VideoState **ps) {
 
     	pthread_create(is->parse_tid, NULL, (void *) &decode_thread, is);
 
-    	av_init_packet(&is->flush_pkt);
-    	is->flush_pkt.data = (unsigned char *)"FLUSH";
-
     	return NO_ERROR;
     }
     return INVALID_OPERATION;
@@ -37,16 +37,57 @@
 
 #include <pthread.h>
 #include "audioplayer.h"
+#include "audio_sink.h"
 #include "videoplayer.h"
 #include <unistd.h>
 #include "Errors.h"
 
 #include "ffmpeg_utils.h"
+#include "packet_queue.h"
+#include "fd_io.h"
+#include "probe_cache.h"
+#include "seek_index.h"
+#include "pcm_ring.h"
+#include "render_stats.h"
 
 #define SDL_AUDIO_BUFFER_SIZE 1024
 #define MAX_AUDIO_FRAME_SIZE 192000
-#define MAX_AUDIOQ_SIZE (5 * 16 * 1024)
-#define MAX_VIDEOQ_SIZE (5 * 256 * 1024)
+/*
+ * The demuxer stops reading once every stream has DEFAULT_BUFFER_MAX_MS of
+ * packets queued, or the queues hold DEFAULT_BUFFER_MAX_BYTES, and resumes
+ * when a stream drops below DEFAULT_BUFFER_MIN_MS.
+ */
+#define DEFAULT_BUFFER_MIN_MS 2500
+#define DEFAULT_BUFFER_MAX_MS 5000
+#define DEFAULT_BUFFER_MAX_BYTES (15 * 1024 * 1024)
+#define MAX_BUFFER_MS (10 * 60 * 1000)
+/*
+ * Output pauses with MEDIA_INFO_BUFFERING_START once the queue of the
+ * master stream drops below the low watermark (0: runs dry) and resumes
+ * with MEDIA_INFO_BUFFERING_END once it holds the high watermark.
+ */
+#define DEFAULT_BUFFERING_LOW_MS 0
+#define DEFAULT_BUFFERING_HIGH_MS 1500
+/* minimum interval between MEDIA_BUFFERING_UPDATE events (us) */
+#define BUFFERING_UPDATE_INTERVAL 1000000
+/*
+ * Fast start probes with these limits and skips avformat_find_stream_info
+ * when the container header already describes every stream.
+ */
+#define DEFAULT_FAST_START_PROBE_SIZE 32768
+#define DEFAULT_FAST_START_ANALYZE_MS 500
+/*
+ * The player is prepared once this much audio is queued for the decoder
+ * and, unless disabled, the first picture is decoded.
+ */
+#define DEFAULT_PREPARED_AUDIO_MS 1000
+/* decoded audio the decode thread keeps ahead of the audio output */
+#define AUDIO_RING_MS 500
+/* highest rate KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE accepts */
+#define AUDIO_OUTPUT_MAX_SAMPLE_RATE 192000
+/* backoff between retries of a read that returned no data (ms) */
+#define READ_RETRY_MIN_DELAY 10
+#define READ_RETRY_MAX_DELAY 1000
 #define AV_SYNC_THRESHOLD 0.01
 #define AV_NOSYNC_THRESHOLD 10.0
 #define SAMPLE_CORRECTION_PERCENT_MAX 10
@@ -69,6 +110,7 @@ typedef enum media_event_type {
 
 typedef enum media_info_type {
 	MEDIA_INFO_UNKNOWN               = 0,
+	MEDIA_INFO_STARTED_AS_NEXT       = 2,
 	MEDIA_INFO_VIDEO_TRACK_LAGGING   = 700,
 	MEDIA_INFO_VIDEO_RENDERING_START = 3,
 	MEDIA_INFO_BUFFERING_START       = 701,
@@ -81,6 +123,14 @@ typedef enum media_info_type {
 	MEDIA_INFO_SUBTITLE_TIMED_OUT    = 902,
 } media_info_type;
 
+/* seekTo modes, the values of the MediaPlayer SEEK_ constants */
+typedef enum media_seek_mode {
+	SEEK_PREVIOUS_SYNC = 0,  // keyframe at or before the target
+	SEEK_NEXT_SYNC     = 1,  // keyframe at or after the target
+	SEEK_CLOSEST_SYNC  = 2,  // keyframe nearest to the target
+	SEEK_CLOSEST       = 3,  // the target, decoding from the keyframe before it
+} media_seek_mode;
+
 typedef int media_error_type;
 static const media_error_type MEDIA_ERROR_UNKNOWN = 1;
 static const media_error_type MEDIA_ERROR_SERVER_DIED = 100;
@@ -97,18 +147,6 @@ typedef enum {
     MEDIA_PLAYER_PLAYBACK_COMPLETE  = 1 << 7
 } media_player_states;
 
-typedef struct PacketQueue {
-  SDL_Window     *screen;
-  SDL_Renderer *renderer;
-  SDL_Texture *texture;
-  int initialized;
-  AVPacketList *first_pkt, *last_pkt;
-  int nb_packets;
-  int size;
-  SDL_mutex *mutex;
-  SDL_cond *cond;
-} PacketQueue;
-
 typedef struct Picture {
 	int linesize;
 	void *buffer;
@@ -121,8 +159,28 @@ typedef struct VideoPicture {
   int width, height; /* source height & width */
   int allocated;
   double pts;
+  int serial;         /* videoq serial of the packet it was decoded from */
 } VideoPicture;
 
+/* av_gettime() when each stage of opening the input completed, 0 until then */
+typedef struct OpenTimings {
+  int64_t start;         /* decode thread started */
+  int64_t io_open;       /* connected, first response read */
+  int64_t input_open;    /* container header parsed */
+  int64_t stream_info;   /* stream parameters known */
+  int64_t first_packet;  /* first packet demuxed */
+  int64_t first_frame;   /* first audio or video frame decoded */
+  int64_t prepared;      /* MEDIA_PREPARED sent */
+} OpenTimings;
+
+/*
+ * Where offline render mode delivers its output: the PCM the audio sink
+ * pulled, and each converted RGBA picture instead of showing it.
+ */
+typedef void (*render_audio_callback) (void *opaque, const uint8_t *pcm, int len);
+typedef void (*render_video_callback) (void *opaque, const uint8_t *rgba, int linesize,
+                                       int width, int height, double pts);
+
 typedef struct VideoState {
   AVFormatContext *pFormatCtx;
   int             videoStream, audioStream;
@@ -132,8 +190,19 @@ typedef struct VideoState {
   int64_t         external_clock_time;
   int             seek_req;
   int             seek_flags;
+  int             seek_mode;
+  int             seek_generation;     /* bumped by every seekTo */
+  int             seek_running;        /* generation of the seek in avformat_seek_file, -1 if none */
+  int             nb_seeks;            /* seeks the demuxer ran */
   int64_t         seek_pos;
   int64_t         seek_rel;
+  double          seek_exact_pts;      /* target of the last SEEK_CLOSEST */
+  int             audio_exact_serial;  /* audioq serial still dropping up to seek_exact_pts, -1 if none */
+  int             video_exact_serial;
+  int64_t         seek_start;          /* av_gettime() of the seek being measured, 0 if none */
+  int             seek_output_serial;  /* serial of the first output after that seek */
+  int             seek_ms;             /* from seekTo to the first output at the new position */
+  int             seek_internal;       /* generation of a seek the player issued, not reported */
 
   double          audio_clock;
   AVStream        *audio_st;
@@ -143,6 +212,8 @@ typedef struct VideoState {
   unsigned int    audio_buf_size;
   unsigned int    audio_buf_index;
   AVPacket        audio_pkt;
+  int             audio_pkt_serial;
+  int             audio_clock_serial;  /* audio_clock is stale if this is not the audioq serial */
   uint8_t         *audio_pkt_data;
   int             audio_pkt_size;
   int             audio_hw_buf_size;
@@ -150,6 +221,17 @@ typedef struct VideoState {
   double          audio_diff_avg_coef;
   double          audio_diff_threshold;
   int             audio_diff_avg_count;
+  PcmRing         audio_ring;      /* decoded samples waiting for the audio output */
+  int             audio_underruns; /* output callbacks the ring could not fill */
+  int             audio_buffer_count;  /* buffers enqueued on the audio output */
+  int             audio_buffer_ms;
+  int             audio_sink_type;     /* an audio_sink_type */
+  char            audio_sink_path[1024];
+  int             audio_output_sample_rate;  /* requested, 0 keeps the source rate */
+  int             audio_output_channels;     /* requested, 0 keeps the source, at most stereo */
+  int             audio_resampler_quality;   /* a media_resampler_quality */
+  int             audio_tgt_sample_rate;     /* format of audio_buf and the sink, set on open */
+  int             audio_tgt_channels;
   double          frame_timer;
   double          frame_last_pts;
   double          frame_last_delay;
@@ -158,31 +240,84 @@ typedef struct VideoState {
   int64_t         video_current_pts_time;  ///<time (av_gettime) at which we updated video_current_pts - used to have running video pts
   AVStream        *video_st;
   PacketQueue     videoq;
+  int             video_pkt_serial;
+  int             video_clock_serial;  /* serial of the last picture shown */
   VideoPicture    pictq[VIDEO_PICTURE_QUEUE_SIZE];
   int             pictq_size, pictq_rindex, pictq_windex;
   SDL_mutex       *pictq_mutex;
   SDL_cond        *pictq_cond;
+  SDL_mutex       *continue_read_mutex;
+  SDL_cond        *continue_read_cond;  /* wakes the demuxer: space, seek or quit */
+  SDL_atomic_t    read_waiting;
+  int             buffer_min_ms;
+  int             buffer_max_ms;
+  int             buffer_max_bytes;
+  SDL_atomic_t    buffering;        /* output paused until the queues refill */
+  int64_t         buffering_start;  /* av_gettime() of the last underrun */
+  int             buffering_low_ms;
+  int             buffering_high_ms;
+  int             eof;
   pthread_t       *parse_tid;
   pthread_t       *video_tid;
+  pthread_t       *audio_tid;
   pthread_t       *video_refresh_tid;
 
   char            filename[1024];
   int             quit;
 
   AVIOContext     *io_context;
+  int (*io_open)(AVFormatContext *s, AVIOContext **pb, const char *url,
+                 int flags, AVDictionary **options);  /* default of pFormatCtx */
+  OpenTimings     open_timings;
+
+  /* offline render mode, no presentation timing */
+  int             offline_render;
+  RenderStage     render_stages[RENDER_STAGE_NB];
+  int64_t         render_start;    /* av_gettime_relative() of the first start, 0 until then */
+  int64_t         render_end;      /* of the last frame delivered, 0 until then */
+  void            *render_opaque;
+  render_audio_callback render_audio;
+  render_video_callback render_video;
+  SDL_atomic_t    decoded_types;  /* 1 << AVMediaType of the streams that decoded a frame */
+  int             prepared_audio_ms;
+  int             prepared_video_frame;
   struct SwsContext *sws_ctx;
   struct SwrContext *sws_ctx_audio;
-  struct AudioPlayer *audio_player;
+  struct AudioSink *audio_sink;
   struct VideoPlayer *video_player;
   void (*audio_callback) (void *userdata, uint8_t *stream, int len);
   int             prepared;
+  int             completed;      /* MEDIA_PLAYBACK_COMPLETE sent */
+  int             loop;
+  int             scrub;          /* preview mode requested with KEY_PARAMETER_SCRUB */
+  int             scrubbing;      /* preview mode applied by the demuxer, needs a video stream */
+  int             scrub_serial;   /* videoq serial whose preview picture is queued */
 
   char headers[2048];
 
   int fd;
   int64_t offset;
+  int64_t length;
+  AVIOContext *fd_io;
+  int mmap_io;
+  int fast_start;
+  int probe_size;
+  int analyze_duration_ms;
+
+  char probe_cache_dir[1024];   /* empty: no probe cache */
+  int probe_cache_max_bytes;
+  char probe_cache_key[PROBE_CACHE_KEY_SIZE];  /* empty if the source has no identity */
+  int probe_cache_hit;
+  int probe_cache_check[AVMEDIA_TYPE_NB];  /* first decoded frame not yet compared with the entry */
+  int seek_index_enabled;
+  SeekIndex seek_index[AVMEDIA_TYPE_NB];   /* keyframes demuxed from the audio and video streams */
 
   int prepare_sync;
+  SDL_mutex *prepare_mutex;
+  SDL_cond *prepare_cond;   /* signalled once prepare_done is set */
+  int prepare_done;
+  int prepare_status;       /* NO_ERROR or why the prepare failed */
+  int prepare_timeout_ms;   /* of a synchronous prepare, 0 waits until done */
 
   void (*notify_callback) (void*, int, int, int, int);
   void* clazz;
@@ -194,8 +329,7 @@ typedef struct VideoState {
 
   pthread_t       *tid;
   int player_started;
-  AVPacket flush_pkt;
-  void *next;
+  void *next;   /* VideoState started when this one completes, see setNextPlayer */
 
   void *native_window;
 
@@ -221,6 +355,91 @@ enum {
   AV_SYNC_EXTERNAL_MASTER,
 };
 
+/*
+ * Keys for setParameter/getParameter, keep in sync with the KEY_PARAMETER
+ * constants in FFmpegMediaPlayer.java.
+ */
+enum media_parameter_keys {
+  /* read only packet queue statistics, summed over the audio and video queues */
+  KEY_PARAMETER_PACKET_POOL_ALLOCS = 2000,  // allocations of the queue storage
+  KEY_PARAMETER_PACKET_MOVES = 2001,        // packets moved into the queues without a copy
+  KEY_PARAMETER_PACKET_COPIES = 2002,       // packets that had to be copied into the queues
+  KEY_PARAMETER_AUDIO_BUFFERED_MS = 2003,   // media time queued for the audio decoder
+  KEY_PARAMETER_VIDEO_BUFFERED_MS = 2004,   // media time queued for the video decoder
+
+  /* read only, milliseconds from prepare to each open stage or -1 if not reached */
+  KEY_PARAMETER_IO_OPEN_MS = 2005,          // connected and first byte available
+  KEY_PARAMETER_INPUT_OPEN_MS = 2006,       // container header parsed
+  KEY_PARAMETER_STREAM_INFO_MS = 2007,      // stream parameters known
+  KEY_PARAMETER_FIRST_PACKET_MS = 2008,     // first packet demuxed
+  KEY_PARAMETER_PROBE_CACHE_HIT = 2009,     // 1 if the stream parameters came from the probe cache
+  KEY_PARAMETER_FIRST_FRAME_MS = 2010,      // first audio or video frame decoded
+  KEY_PARAMETER_PREPARED_MS = 2011,         // MEDIA_PREPARED sent
+  KEY_PARAMETER_SEEK_MS = 2012,             // from the last seekTo to the first output at its position
+  KEY_PARAMETER_SEEKS = 2013,               // seeks the demuxer ran, newer seekTo calls replace pending ones
+  KEY_PARAMETER_AUDIO_DECODED_MS = 2014,    // decoded audio waiting for the output
+  KEY_PARAMETER_AUDIO_UNDERRUNS = 2015,     // output buffers the audio decoder could not fill in time
+  KEY_PARAMETER_AUDIO_PLAYED_MS = 2016,     // audio the sink played since prepare
+
+  /*
+   * read only, offline render mode: the whole render, then the wall time,
+   * CPU time and frames per second of each render_stage
+   */
+  KEY_PARAMETER_RENDER_MS = 2017,
+  KEY_PARAMETER_RENDER_DEMUX_MS = 2018,
+  KEY_PARAMETER_RENDER_DEMUX_CPU_MS = 2019,
+  KEY_PARAMETER_RENDER_DEMUX_FPS = 2020,    // packets per second
+  KEY_PARAMETER_RENDER_AUDIO_DECODE_MS = 2021,
+  KEY_PARAMETER_RENDER_AUDIO_DECODE_CPU_MS = 2022,
+  KEY_PARAMETER_RENDER_AUDIO_DECODE_FPS = 2023,
+  KEY_PARAMETER_RENDER_VIDEO_DECODE_MS = 2024,
+  KEY_PARAMETER_RENDER_VIDEO_DECODE_CPU_MS = 2025,
+  KEY_PARAMETER_RENDER_VIDEO_DECODE_FPS = 2026,
+  KEY_PARAMETER_RENDER_VIDEO_CONVERT_MS = 2027,
+  KEY_PARAMETER_RENDER_VIDEO_CONVERT_CPU_MS = 2028,
+  KEY_PARAMETER_RENDER_VIDEO_CONVERT_FPS = 2029,
+
+  /* buffer limits, set after setDataSource and before prepare */
+  KEY_PARAMETER_BUFFER_MIN_MS = 2100,
+  KEY_PARAMETER_BUFFER_MAX_MS = 2101,
+  KEY_PARAMETER_BUFFER_MAX_BYTES = 2102,
+  KEY_PARAMETER_BUFFERING_LOW_MS = 2103,
+  KEY_PARAMETER_BUFFERING_HIGH_MS = 2104,
+  KEY_PARAMETER_MMAP_IO = 2105,             // 1 maps local files and fds, 0 reads them with pread
+  KEY_PARAMETER_FAST_START = 2106,          // 1 probes with the limits below and skips find_stream_info if possible
+  KEY_PARAMETER_PROBE_SIZE = 2107,          // bytes probed in fast start
+  KEY_PARAMETER_ANALYZE_DURATION_MS = 2108, // media time analyzed in fast start
+  KEY_PARAMETER_PROBE_CACHE_DIR = 2109,     // string, directory of the probe cache, empty disables it
+  KEY_PARAMETER_PROBE_CACHE_MAX_BYTES = 2110,
+  KEY_PARAMETER_PREPARED_AUDIO_MS = 2111,   // audio queued before MEDIA_PREPARED
+  KEY_PARAMETER_PREPARED_VIDEO_FRAME = 2112,// 1 waits for the first decoded picture before MEDIA_PREPARED
+  KEY_PARAMETER_PREPARE_TIMEOUT_MS = 2113,  // limit of a synchronous prepare, 0 waits until done
+  KEY_PARAMETER_SEEK_INDEX = 2114,          // 1 seeks through the keyframes read so far if the format has no index
+  KEY_PARAMETER_SCRUB = 2115,               // 1 previews seeks with keyframes only and no audio, any time
+  KEY_PARAMETER_AUDIO_BUFFERS = 2116,       // a media_audio_buffers preset, -1 when read back if neither
+  KEY_PARAMETER_AUDIO_BUFFER_COUNT = 2117,  // buffers enqueued on the audio output
+  KEY_PARAMETER_AUDIO_BUFFER_MS = 2118,     // audio held by each of them
+  KEY_PARAMETER_AUDIO_SINK = 2119,          // an audio_sink_type, set before prepare
+  KEY_PARAMETER_AUDIO_SINK_PATH = 2120,     // string, file of the WAV sinks
+  KEY_PARAMETER_OFFLINE_RENDER = 2121,      // 1 decodes as fast as possible, set before prepare
+  KEY_PARAMETER_AUDIO_OUTPUT_SAMPLE_RATE = 2122,  // rate the audio is resampled to, 0 keeps the source rate
+  KEY_PARAMETER_AUDIO_OUTPUT_CHANNELS = 2123,     // 1 or 2, 0 keeps the source and downmixes more to stereo
+  KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY = 2124,   // a media_resampler_quality
+};
+
+/* values of KEY_PARAMETER_AUDIO_BUFFERS */
+enum media_audio_buffers {
+  AUDIO_BUFFERS_LOW_POWER = 0,    // AUDIO_BUFFERS_LOW_POWER_COUNT x AUDIO_BUFFERS_LOW_POWER_MS
+  AUDIO_BUFFERS_LOW_LATENCY = 1,  // AUDIO_BUFFERS_LOW_LATENCY_COUNT x AUDIO_BUFFERS_LOW_LATENCY_MS
+};
+
+/* values of KEY_PARAMETER_AUDIO_RESAMPLER_QUALITY */
+enum media_resampler_quality {
+  RESAMPLER_QUALITY_FAST = 0,     // short filter, interpolated phases
+  RESAMPLER_QUALITY_DEFAULT = 1,  // the swresample defaults
+  RESAMPLER_QUALITY_HIGH = 2,     // long filter, higher cutoff
+};
+
 int private_main(int argc, char *argv[]);
 
 VideoState *create();
@@ -235,12 +454,14 @@ int getMetadata(VideoState **ps, AVDictionary **metadata);
 int prepare(VideoState **ps);
 int prepareAsync(VideoState **ps);
 int start(VideoState **ps);
+/* Returns ALREADY_EXISTS if the previous player handed its audio sink over */
+int startAsNext(VideoState **ps);
 int stop(VideoState **ps);
 int pause_l(VideoState **ps);
 int isPlaying(VideoState **ps);
 int getVideoWidth(VideoState **ps, int *w);
 int getVideoHeight(VideoState **ps, int *h);
-int seekTo(VideoState **ps, int msec);
+int seekTo(VideoState **ps, int msec, int mode);
 int getCurrentPosition(VideoState **ps, int *msec);
 int getDuration(VideoState **ps, int *msec);
 int reset(VideoState **ps);
@@ -251,10 +472,18 @@ int setVolume(VideoState **ps, float leftVolume, float rightVolume);
 void notify(VideoState *is, int msg, int ext1, int ext2);
 void notify_from_thread(VideoState *is, int msg, int ext1, int ext2);
 int setNextPlayer(VideoState **ps, VideoState *next);
+int setParameter(VideoState **ps, int key, int value);
+int getParameter(VideoState **ps, int key, int *value);
+int setStringParameter(VideoState **ps, int key, const char *value);
+int setRenderCallbacks(VideoState **ps, void *opaque, render_audio_callback audio,
+                       render_video_callback video);
+void recyclePacketQueues(VideoState **ps, VideoState **from);
 
 void clear_l(VideoState **ps);
-int seekTo_l(VideoState **ps, int msec);
+int seekTo_l(VideoState **ps, int msec, int mode);
 int prepareAsync_l(VideoState **ps);
 int getDuration_l(VideoState **ps, int *msec);
+int audio_output_done(VideoState *is);
+int audio_samples_ready(VideoState *is, int len);
 
 #endif /* FFMPEG_PLAYER_H_ */
@@ -34,6 +34,10 @@ extern "C" {
 
 using namespace std;
 
+// guards the links between players set with setNextMediaPlayer and the
+// state of a linked player; taken after mLock, never before
+static Mutex sNextLock;
+
 MediaPlayer::MediaPlayer()
 {
     //__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "constructor");
@@ -41,6 +45,7 @@ MediaPlayer::MediaPlayer()
     state = NULL;
     
     mListener = NULL;
+    mRenderListener = NULL;
     mCookie = NULL;
     mDuration = -1;
     mStreamType = 3;
@@ -55,6 +60,9 @@ MediaPlayer::MediaPlayer()
     //mLockThreadId = 0;
     mAudioSessionId = 0;
     mSendLevel = 0;
+    mRefs = 1;
+    mNextPlayer = NULL;
+    mPrevPlayer = NULL;
 }
 
 MediaPlayer::~MediaPlayer()
@@ -70,12 +78,49 @@ void MediaPlayer::disconnect()
     VideoState *p = NULL;
     {
         Mutex::Autolock _l(mLock);
-        p = state;
+        {
+            Mutex::Autolock _n(sNextLock);
+            clearNextPlayers_l();
+            p = state;
+            state = NULL;
+        }
         ::reset(&p);
     }
 
-    if (state != 0) {
-        ::disconnect(&state);
+    if (p != 0) {
+        ::disconnect(&p);
+    }
+}
+
+void MediaPlayer::incStrong()
+{
+    __sync_fetch_and_add(&mRefs, 1);
+}
+
+void MediaPlayer::decStrong()
+{
+    if (__sync_sub_and_fetch(&mRefs, 1) == 0) {
+        delete this;
+    }
+}
+
+// must call with sNextLock held
+void MediaPlayer::unlinkNextPlayer_l()
+{
+    if (mNextPlayer != NULL) {
+        ::setNextPlayer(&state, NULL);
+        mNextPlayer->mPrevPlayer = NULL;
+        mNextPlayer->decStrong();
+        mNextPlayer = NULL;
+    }
+}
+
+// must call with sNextLock held, before state is reset or replaced
+void MediaPlayer::clearNextPlayers_l()
+{
+    unlinkNextPlayer_l();
+    if (mPrevPlayer != NULL) {
+        mPrevPlayer->unlinkNextPlayer_l();
     }
 }
 
@@ -111,6 +156,44 @@ MediaPlayerListener * MediaPlayer::getListener()
     return mListener;
 }
 
+static void
+renderAudioListener(void* opaque, const uint8_t *pcm, int len)
+{
+    MediaPlayer* mp = (MediaPlayer*) opaque;
+    mp->renderAudio(pcm, len);
+}
+
+static void
+renderVideoListener(void* opaque, const uint8_t *rgba, int linesize, int width, int height, double pts)
+{
+    MediaPlayer* mp = (MediaPlayer*) opaque;
+    mp->renderVideo(rgba, linesize, width, height, pts);
+}
+
+// the listener must outlive the player, or at least its current data source
+status_t MediaPlayer::setRenderListener(MediaRenderListener *listener)
+{
+    Mutex::Autolock _l(mLock);
+    mRenderListener = listener;
+    return NO_ERROR;
+}
+
+void MediaPlayer::renderAudio(const uint8_t *pcm, int len)
+{
+    MediaRenderListener *listener = mRenderListener;
+    if (listener != 0) {
+        listener->renderAudio(pcm, len);
+    }
+}
+
+void MediaPlayer::renderVideo(const uint8_t *rgba, int linesize, int width, int height, double pts)
+{
+    MediaRenderListener *listener = mRenderListener;
+    if (listener != 0) {
+        listener->renderVideo(rgba, linesize, width, height, pts);
+    }
+}
+
 status_t MediaPlayer::setDataSource(VideoState *player)
 {
     status_t err = UNKNOWN_ERROR;
@@ -126,8 +209,15 @@ status_t MediaPlayer::setDataSource(VideoState *player)
 
         ::clear_l(&player);
 	    ::setListener(&player, this, notifyListener);
+	    ::setRenderCallbacks(&player, this, renderAudioListener, renderVideoListener);
         clear_l();
+        Mutex::Autolock _n(sNextLock);
+        clearNextPlayers_l();
         p = state;
+        if (p != 0 && (mCurrentState & MEDIA_PLAYER_IDLE)) {
+            // the old player has been reset, reuse its packet queues
+            ::recyclePacketQueues(&player, &p);
+        }
         state = player;
         if (player != 0) {
             mCurrentState = MEDIA_PLAYER_INITIALIZED;
@@ -172,7 +262,11 @@ status_t MediaPlayer::setDataSource(int fd, int64_t offset, int64_t length)
         //sp<IMediaPlayer> player(service->create(getpid(), this, fd, offset, length, mAudioSessionId));
     	VideoState* state = create();
     	err = ::setDataSourceFD(&state, fd, offset, length);
-        err = setDataSource(state);
+    	if (err == NO_ERROR) {
+    	    err = setDataSource(state);
+    	} else {
+    	    ::disconnect(&state);
+    	}
     //}
     return err;
 }
@@ -235,16 +329,24 @@ status_t MediaPlayer::prepare()
 	return -EALREADY;
 	}
 	mPrepareSync = true;
+	mPrepareStatus = NO_ERROR;
+	// returns once the decode thread prepared the source or failed
 	status_t ret = ::prepare(&state);
 	//status_t ret = prepareAsync_l();
+	mPrepareSync = false;
+	if (ret == TIMED_OUT) {
+	// still preparing, completion is reported like an asynchronous prepare
+	mCurrentState = MEDIA_PLAYER_PREPARING;
+	return ret;
+	}
 	if (ret != NO_ERROR) {
 	//mLockThreadId = 0;
+	mCurrentState = MEDIA_PLAYER_STATE_ERROR;
 	return ret;
 	}
-	if (mPrepareSync) {
-	//mSignal.wait(mLock); // wait for prepare done
-	mPrepareSync = false;
-	}
+	// MEDIA_PREPARED is delivered later from the notification thread
+	mCurrentState = MEDIA_PLAYER_PREPARED;
+	mPrepareStatus = ret;
 	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "prepare complete - status=%d", mPrepareStatus);
 	//mLockThreadId = 0;
 	return mPrepareStatus;
@@ -399,7 +501,7 @@ status_t MediaPlayer::getDuration(int *msec)
     return getDuration_l(msec);
 }
 
-status_t MediaPlayer::seekTo_l(int msec)
+status_t MediaPlayer::seekTo_l(int msec, int mode)
 {
 	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "seekTo %d", msec);
     if ((state != 0) && ( mCurrentState & ( MEDIA_PLAYER_STARTED | MEDIA_PLAYER_PREPARED | MEDIA_PLAYER_PAUSED | MEDIA_PLAYER_PLAYBACK_COMPLETE) ) ) {
@@ -412,25 +514,25 @@ status_t MediaPlayer::seekTo_l(int msec)
         }
         // cache duration
         mCurrentPosition = msec;
-        if (mSeekPosition < 0) {
-            getDuration_l(NULL);
-            mSeekPosition = msec;
-            return ::seekTo(&state, msec);
-        }
-        else {
-        	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "Seek in progress - queue up seekTo[%d]", msec);
-            return NO_ERROR;
-        }
+        getDuration_l(NULL);
+        // the player replaces a seek in progress with this one
+        mSeekPosition = msec;
+        return ::seekTo(&state, msec, mode);
     }
     //__android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "Attempt to perform seekTo in wrong state: mPlayer=%p, mCurrentState=%u", state, mCurrentState);
     return INVALID_OPERATION;
 }
 
 status_t MediaPlayer::seekTo(int msec)
+{
+    return seekTo(msec, SEEK_PREVIOUS_SYNC);
+}
+
+status_t MediaPlayer::seekTo(int msec, int mode)
 {
     //mLockThreadId = getThreadId();
     Mutex::Autolock _l(mLock);
-    status_t result = seekTo_l(msec);
+    status_t result = seekTo_l(msec, mode);
     //mLockThreadId = 0;
 
     return result;
@@ -443,6 +545,10 @@ status_t MediaPlayer::reset()
     mLoop = false;
     if (mCurrentState == MEDIA_PLAYER_IDLE) return NO_ERROR;
     mPrepareSync = false;
+    {
+        Mutex::Autolock _n(sNextLock);
+        clearNextPlayers_l();
+    }
     if (state != 0) {
         status_t ret = ::reset(&state);
         if (ret != NO_ERROR) {
@@ -599,7 +705,10 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
         break;
     case MEDIA_PREPARED:
     	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "prepared");
-        mCurrentState = MEDIA_PLAYER_PREPARED;
+        // a synchronous prepare has already moved on, maybe to started
+        if (mCurrentState == MEDIA_PLAYER_PREPARING) {
+            mCurrentState = MEDIA_PLAYER_PREPARED;
+        }
         if (mPrepareSync) {
         	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "signal application thread");
             mPrepareSync = false;
@@ -635,15 +744,15 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
         // ext1: Media framework error code.
         // ext2: Implementation dependant error code.
     	//__android_log_print(ANDROID_LOG_WARN, LOG_TAG, "info/warning (%d, %d)", ext1, ext2);
+        // the previous player completed and handed its output over
+        if (ext1 == MEDIA_INFO_STARTED_AS_NEXT) {
+            mCurrentState = MEDIA_PLAYER_STARTED;
+        }
         break;
     case MEDIA_SEEK_COMPLETE:
     	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "Received seek complete");
-        if (mSeekPosition != mCurrentPosition) {
-        	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "Executing queued seekTo(%d)", mSeekPosition);
-            mSeekPosition = -1;
-            seekTo_l(mCurrentPosition);
-        }
-        else {
+        // ext1: position of the seek, only the latest seekTo completes
+        if (ext1 == mSeekPosition) {
         	//__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "All seeks complete - return to regularly scheduled program");
             mCurrentPosition = mSeekPosition = -1;
         }
@@ -671,13 +780,110 @@ void MediaPlayer::notify(int msg, int ext1, int ext2, int fromThread)
         listener->notify(msg, ext1, ext2, fromThread);
         //__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "back from callback");
     }
+
+    if (msg == MEDIA_PLAYBACK_COMPLETE && !mLoop) {
+        startNextPlayer();
+    }
 }
 
-status_t MediaPlayer::setNextMediaPlayer(const MediaPlayer* next) {
+// Starts the player set with setNextMediaPlayer once this one completed,
+// unless this player's audio callback already handed its output over
+void MediaPlayer::startNextPlayer()
+{
+    MediaPlayer *next;
+    {
+        Mutex::Autolock _n(sNextLock);
+        next = mNextPlayer;
+        if (next != NULL) {
+            next->incStrong();
+        }
+    }
+
+    if (next != NULL) {
+        next->startAsNext();
+        next->decStrong();
+    }
+}
+
+status_t MediaPlayer::startAsNext()
+{
+    {
+        Mutex::Autolock _l(mLock);
+        if (state == 0 || !(mCurrentState & MEDIA_PLAYER_PREPARED)) {
+            return INVALID_OPERATION;
+        }
+        ::setLooping(&state, mLoop);
+        ::setVolume(&state, mLeftVolume, mRightVolume);
+        status_t ret = ::startAsNext(&state);
+        if (ret == ALREADY_EXISTS) {
+            // MEDIA_INFO_STARTED_AS_NEXT is on its way
+            return NO_ERROR;
+        }
+        if (ret != NO_ERROR) {
+            mCurrentState = MEDIA_PLAYER_STATE_ERROR;
+            return ret;
+        }
+        mCurrentState = MEDIA_PLAYER_STARTED;
+    }
+
+    notify(MEDIA_INFO, MEDIA_INFO_STARTED_AS_NEXT, 0, 1);
+    return NO_ERROR;
+}
+
+status_t MediaPlayer::setParameter(int key, int value)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setParameter(%d, %d)", key, value);
+    Mutex::Autolock _l(mLock);
+    if (state == 0) {
+        return NO_INIT;
+    }
+    return ::setParameter(&state, key, value);
+}
+
+status_t MediaPlayer::setParameter(int key, const char *value)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::setParameter(%d, %s)", key, value);
+    Mutex::Autolock _l(mLock);
+    if (state == 0) {
+        return NO_INIT;
+    }
+    return ::setStringParameter(&state, key, value);
+}
+
+status_t MediaPlayer::getParameter(int key, int *value)
+{
+	//__android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "MediaPlayer::getParameter(%d)", key);
+    Mutex::Autolock _l(mLock);
+    if (state == 0) {
+        return NO_INIT;
+    }
+    return ::getParameter(&state, key, value);
+}
+
+status_t MediaPlayer::setNextMediaPlayer(MediaPlayer* next) {
+    Mutex::Autolock _l(mLock);
     if (state == NULL) {
         return NO_INIT;
     }
-    return ::setNextPlayer(&state, next == NULL ? NULL : next->state);
+    Mutex::Autolock _n(sNextLock);
+    unlinkNextPlayer_l();
+    if (next == NULL) {
+        return NO_ERROR;
+    }
+    if (next->state == NULL) {
+        return NO_INIT;
+    }
+    // a player is the next of one player at a time
+    if (next->mPrevPlayer != NULL) {
+        next->mPrevPlayer->unlinkNextPlayer_l();
+    }
+    status_t ret = ::setNextPlayer(&state, next->state);
+    if (ret == NO_ERROR) {
+        next->incStrong();
+        mNextPlayer = next;
+        next->mPrevPlayer = this;
+    }
+    return ret;
 }
 
 /*static*/ /*sp<IMemory> MediaPlayer::decode(const char* url, uint32_t *pSampleRate, int* pNumChannels, int* pFormat)
@@ -60,6 +60,14 @@ public:
     virtual void notify(int msg, int ext1, int ext2, int fromThread) = 0;
 };
 
+// receives the output of offline render mode, called on the render threads
+class MediaRenderListener
+{
+public:
+    virtual void renderAudio(const uint8_t *pcm, int len) = 0;
+    virtual void renderVideo(const uint8_t *rgba, int linesize, int width, int height, double pts) = 0;
+};
+
 class MediaPlayer
 {
 public:
@@ -74,6 +82,7 @@ public:
             status_t        setVideoSurface(void* native_window);
             status_t        setListener(MediaPlayerListener *listener);
             MediaPlayerListener * getListener();
+            status_t        setRenderListener(MediaRenderListener *listener);
             status_t        prepare();
             status_t        prepareAsync();
             status_t        start();
@@ -83,6 +92,7 @@ public:
             status_t        getVideoWidth(int *w);
             status_t        getVideoHeight(int *h);
             status_t        seekTo(int msec);
+            status_t        seekTo(int msec, int mode);
             status_t        getCurrentPosition(int *msec);
             status_t        getDuration(int *msec);
             status_t        reset();
@@ -91,20 +101,32 @@ public:
             bool            isLooping();
             status_t        setVolume(float leftVolume, float rightVolume);
             void            notify(int msg, int ext1, int ext, int fromThread);
+            void            renderAudio(const uint8_t *pcm, int len);
+            void            renderVideo(const uint8_t *rgba, int linesize, int width, int height, double pts);
             status_t        setAudioSessionId(int sessionId);
             int             getAudioSessionId();
             status_t        setAuxEffectSendLevel(float level);
             int             attachAuxEffect(int effectId);
-            status_t        setNextMediaPlayer(const MediaPlayer* player);
+            status_t        setNextMediaPlayer(MediaPlayer* player);
+            status_t        setParameter(int key, int value);
+            status_t        setParameter(int key, const char *value);
+            status_t        getParameter(int key, int *value);
+            // the player is deleted once the last reference is dropped
+            void            incStrong();
+            void            decStrong();
 
     VideoState*                      state;
         
 private:
             void            clear_l();
-            status_t        seekTo_l(int msec);
+            status_t        seekTo_l(int msec, int mode);
             status_t        prepareAsync_l();
             status_t        getDuration_l(int *msec);
             status_t        setDataSource(VideoState *state);
+            void            unlinkNextPlayer_l();
+            void            clearNextPlayers_l();
+            void            startNextPlayer();
+            status_t        startAsNext();
         
     //sp<IMediaPlayer>            mPlayer;
     //thread_id_t                 mLockThreadId;
@@ -112,6 +134,7 @@ private:
     Mutex                       mNotifyLock;
     //Condition                   mSignal;
     MediaPlayerListener*        mListener;
+    MediaRenderListener*        mRenderListener;
     void*                       mCookie;
     media_player_states         mCurrentState;
     int                         mDuration;
@@ -127,6 +150,10 @@ private:
     int                         mVideoHeight;
     int                         mAudioSessionId;
     float                       mSendLevel;
+    int32_t                     mRefs;
+    // guarded by sNextLock, mNextPlayer holds a reference
+    MediaPlayer*                mNextPlayer;
+    MediaPlayer*                mPrevPlayer;
     };
 
 #endif // MEDIAPLAYER_H
@@ -0,0 +1,295 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ffmpeg_mediaplayer.h>
+#include <packet_queue.h>
+
+#define PACKET_QUEUE_MASK (PACKET_QUEUE_SIZE - 1)
+
+/*
+ * The slot array and the sync primitives are allocated on first use and
+ * then kept for the lifetime of the player; a later init (after reset)
+ * only rewinds the ring.
+ */
+int packet_queue_init(PacketQueue *q, AVRational time_base) {
+  if (!q->pkts) {
+    q->pkts = av_mallocz(PACKET_QUEUE_SIZE * sizeof(PacketQueueEntry));
+    if (!q->pkts) {
+      return -1;
+    }
+    q->mutex = SDL_CreateMutex();
+    q->cond = SDL_CreateCond();
+    q->space_cond = SDL_CreateCond();
+    SDL_AtomicAdd(&q->nb_allocs, 1);
+  }
+
+  packet_queue_clear(q);
+  q->time_base = time_base;
+  q->initialized = 1;
+  return 0;
+}
+
+/* Drop the queued packets and rewind the ring, keeping its storage */
+void packet_queue_clear(PacketQueue *q) {
+  unsigned int rindex, windex;
+
+  if (!q->pkts) {
+    return;
+  }
+
+  /* the threads using the queue have been joined at this point */
+  rindex = SDL_AtomicGet(&q->rindex);
+  windex = SDL_AtomicGet(&q->windex);
+  for (; rindex != windex; rindex++) {
+    av_packet_unref(&q->pkts[rindex & PACKET_QUEUE_MASK].pkt);
+  }
+
+  SDL_AtomicSet(&q->windex, 0);
+  SDL_AtomicSet(&q->serial, 0);
+  SDL_AtomicSet(&q->producer_waiting, 0);
+  SDL_AtomicSet(&q->rindex, 0);
+  SDL_AtomicSet(&q->consumer_waiting, 0);
+  SDL_AtomicSet(&q->drained, 0);
+  SDL_AtomicSet(&q->nb_packets, 0);
+  SDL_AtomicSet(&q->put_size, 0);
+  SDL_AtomicSet(&q->put_duration, 0);
+  SDL_AtomicSet(&q->flush_size, 0);
+  SDL_AtomicSet(&q->flush_duration, 0);
+  SDL_AtomicSet(&q->got_size, 0);
+  SDL_AtomicSet(&q->got_duration, 0);
+  q->initialized = 0;
+}
+
+void packet_queue_destroy(PacketQueue *q) {
+  if (!q->pkts) {
+    return;
+  }
+
+  packet_queue_clear(q);
+  av_freep(&q->pkts);
+
+  SDL_DestroyCond(q->space_cond);
+  SDL_DestroyCond(q->cond);
+  SDL_DestroyMutex(q->mutex);
+  memset(q, 0, sizeof(PacketQueue));
+}
+
+/* Wake whichever side is sleeping on the queue, e.g. after quit is set */
+void packet_queue_wake(PacketQueue *q) {
+  if (!q->pkts) {
+    return;
+  }
+
+  SDL_LockMutex(q->mutex);
+  SDL_CondSignal(q->cond);
+  SDL_CondSignal(q->space_cond);
+  SDL_UnlockMutex(q->mutex);
+}
+
+/* Duration of a queued packet in AV_TIME_BASE units */
+static int packet_queue_pkt_duration(PacketQueue *q, AVPacket *pkt) {
+  if (pkt->duration <= 0 || q->time_base.den == 0) {
+    return 0;
+  }
+  return (int) av_rescale_q(pkt->duration, q->time_base, AV_TIME_BASE_Q);
+}
+
+/*
+ * Takes ownership of pkt: its reference is moved into the ring slot and pkt
+ * is left blank. Only packets without a reference counted buffer are copied.
+ */
+int packet_queue_put(VideoState *is, PacketQueue *q, AVPacket *pkt) {
+  unsigned int windex;
+  PacketQueueEntry *entry;
+  AVPacket *slot;
+
+  windex = SDL_AtomicGet(&q->windex);
+
+  /* the ring is full, sleep until the consumer releases a slot */
+  while (windex - (unsigned int) SDL_AtomicGet(&q->rindex) >= PACKET_QUEUE_SIZE) {
+    SDL_LockMutex(q->mutex);
+    SDL_AtomicSet(&q->producer_waiting, 1);
+    if (!is->quit &&
+        windex - (unsigned int) SDL_AtomicGet(&q->rindex) >= PACKET_QUEUE_SIZE) {
+      SDL_CondWait(q->space_cond, q->mutex);
+    }
+    SDL_AtomicSet(&q->producer_waiting, 0);
+    SDL_UnlockMutex(q->mutex);
+
+    if (is->quit) {
+      av_packet_unref(pkt);
+      return -1;
+    }
+  }
+
+  entry = &q->pkts[windex & PACKET_QUEUE_MASK];
+  entry->serial = SDL_AtomicGet(&q->serial);
+  /* blank: get moves the packet out and a dropped one is unreferenced */
+  slot = &entry->pkt;
+  if (pkt->buf) {
+    av_packet_move_ref(slot, pkt);
+    SDL_AtomicAdd(&q->nb_moved, 1);
+  } else {
+    if (av_packet_ref(slot, pkt) < 0) {
+      av_packet_unref(pkt);
+      return -1;
+    }
+    av_packet_unref(pkt);
+    SDL_AtomicAdd(&q->nb_copied, 1);
+  }
+  SDL_AtomicAdd(&q->nb_packets, 1);
+  SDL_AtomicAdd(&q->put_size, slot->size);
+  SDL_AtomicAdd(&q->put_duration, packet_queue_pkt_duration(q, slot));
+
+  /* publish the slot to the consumer */
+  SDL_AtomicSet(&q->windex, windex + 1);
+
+  if (SDL_AtomicGet(&q->consumer_waiting)) {
+    SDL_LockMutex(q->mutex);
+    SDL_CondSignal(q->cond);
+    SDL_UnlockMutex(q->mutex);
+  }
+  return 0;
+}
+
+/* Release the slot at rindex, called by the consumer only */
+static void packet_queue_release(PacketQueue *q, unsigned int rindex,
+                                 int size, int duration) {
+  SDL_AtomicAdd(&q->nb_packets, -1);
+  SDL_AtomicAdd(&q->got_size, size);
+  SDL_AtomicAdd(&q->got_duration, duration);
+  SDL_AtomicSet(&q->rindex, rindex + 1);
+
+  if (SDL_AtomicGet(&q->producer_waiting)) {
+    SDL_LockMutex(q->mutex);
+    SDL_CondSignal(q->space_cond);
+    SDL_UnlockMutex(q->mutex);
+  }
+}
+
+/*
+ * Packets put before the last flush are dropped here, so a seek never
+ * walks the ring. The serial of the returned packet is stored in serial,
+ * the caller compares it with packet_queue_serial to discard what it
+ * decoded from a packet that was taken just before a flush.
+ */
+int packet_queue_get(VideoState *is, PacketQueue *q, AVPacket *pkt, int block, int *serial)
+{
+  unsigned int rindex;
+  PacketQueueEntry *entry;
+  int size, duration;
+
+  for(;;) {
+
+    if(is->quit) {
+      return -1;
+    }
+
+    rindex = SDL_AtomicGet(&q->rindex);
+
+    while (rindex != (unsigned int) SDL_AtomicGet(&q->windex)) {
+      entry = &q->pkts[rindex & PACKET_QUEUE_MASK];
+
+      if (entry->serial != SDL_AtomicGet(&q->serial)) {
+        /* queued before the last flush */
+        size = entry->pkt.size;
+        duration = packet_queue_pkt_duration(q, &entry->pkt);
+        av_packet_unref(&entry->pkt);
+        packet_queue_release(q, rindex, size, duration);
+        rindex++;
+        continue;
+      }
+
+      /* leaves the slot blank, the packet belongs to the caller now */
+      av_packet_move_ref(pkt, &entry->pkt);
+      if (serial) {
+        *serial = entry->serial;
+      }
+      /* cleared before the count drops, see packet_queue_drained */
+      SDL_AtomicSet(&q->drained, 0);
+      packet_queue_release(q, rindex, pkt->size, packet_queue_pkt_duration(q, pkt));
+      return 1;
+    }
+
+    SDL_AtomicSet(&q->drained, 1);
+    if (!block) {
+      return 0;
+    }
+
+    SDL_LockMutex(q->mutex);
+    SDL_AtomicSet(&q->consumer_waiting, 1);
+    if (!is->quit && rindex == (unsigned int) SDL_AtomicGet(&q->windex)) {
+      SDL_CondWait(q->cond, q->mutex);
+    }
+    SDL_AtomicSet(&q->consumer_waiting, 0);
+    SDL_UnlockMutex(q->mutex);
+  }
+}
+
+/*
+ * Called by the producer. The slots are still owned by the consumer, so
+ * the flush only starts a new serial; the consumer drops the packets of
+ * older serials on its next get.
+ */
+void packet_queue_flush(PacketQueue *q) {
+  SDL_AtomicSet(&q->flush_size, SDL_AtomicGet(&q->put_size));
+  SDL_AtomicSet(&q->flush_duration, SDL_AtomicGet(&q->put_duration));
+  SDL_AtomicAdd(&q->serial, 1);
+}
+
+/*
+ * What was put since the last flush and not taken yet. The ring is FIFO,
+ * so the consumer is past every packet of an older serial once its total
+ * reaches the mark of the flush. got is read first and never passes put.
+ */
+static int packet_queue_live(SDL_atomic_t *put, SDL_atomic_t *flushed, SDL_atomic_t *got) {
+  unsigned int g = SDL_AtomicGet(got);
+  unsigned int f = SDL_AtomicGet(flushed);
+  unsigned int p = SDL_AtomicGet(put);
+
+  if ((int) (f - g) > 0) {
+    g = f;
+  }
+  return (int) (p - g);
+}
+
+int packet_queue_serial(PacketQueue *q) {
+  return SDL_AtomicGet(&q->serial);
+}
+
+int packet_queue_nb_packets(PacketQueue *q) {
+  return SDL_AtomicGet(&q->nb_packets);
+}
+
+/*
+ * Whether the consumer took every packet queued so far and is back for
+ * more, i.e. it finished decoding them. The count is read first: a get
+ * clears drained before it releases the packet, so a packet taken after
+ * the consumer found the queue empty is never reported as drained.
+ */
+int packet_queue_drained(PacketQueue *q) {
+  return !SDL_AtomicGet(&q->nb_packets) && SDL_AtomicGet(&q->drained);
+}
+
+int packet_queue_size(PacketQueue *q) {
+  return packet_queue_live(&q->put_size, &q->flush_size, &q->got_size);
+}
+
+int packet_queue_duration_ms(PacketQueue *q) {
+  return packet_queue_live(&q->put_duration, &q->flush_duration, &q->got_duration) / 1000;
+}
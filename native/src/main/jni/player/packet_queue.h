@@ -0,0 +1,94 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PACKET_QUEUE_H_
+#define PACKET_QUEUE_H_
+
+#include <libavcodec/avcodec.h>
+
+#include <SDL.h>
+#include <SDL_atomic.h>
+#include <SDL_thread.h>
+
+/* number of packet slots in the ring, must be a power of two */
+#define PACKET_QUEUE_SIZE 1024
+#define CACHE_LINE_SIZE 64
+
+struct VideoState;
+
+typedef struct PacketQueueEntry {
+  AVPacket pkt;
+  int serial;            /* queue serial the packet was put with */
+} PacketQueueEntry;
+
+/*
+ * Bounded single-producer/single-consumer ring of AVPackets. The demux
+ * thread is the only producer and one decoder is the only consumer, so
+ * the indices are advanced without a lock; the mutex is only taken by a
+ * side that has to sleep because the ring is empty or full.
+ */
+typedef struct PacketQueue {
+  PacketQueueEntry *pkts;
+  int initialized;
+  SDL_mutex *mutex;
+  SDL_cond *cond;        /* signalled when a packet is available */
+  SDL_cond *space_cond;  /* signalled when a slot is released */
+  AVRational time_base;  /* of the packets' durations */
+
+  /* owned by the producer */
+  char pad0[CACHE_LINE_SIZE];
+  SDL_atomic_t windex;
+  SDL_atomic_t serial;   /* bumped by every flush */
+  SDL_atomic_t producer_waiting;
+  SDL_atomic_t nb_moved;   /* packets whose reference was moved in */
+  SDL_atomic_t nb_copied;  /* packets that had to be copied */
+  SDL_atomic_t nb_allocs;  /* allocations of the slot array */
+  SDL_atomic_t put_size;   /* totals of the packets ever put, wrap around */
+  SDL_atomic_t put_duration;
+  SDL_atomic_t flush_size; /* put_* when the last flush started a serial */
+  SDL_atomic_t flush_duration;
+
+  /* owned by the consumer */
+  char pad1[CACHE_LINE_SIZE];
+  SDL_atomic_t rindex;
+  SDL_atomic_t consumer_waiting;
+  SDL_atomic_t drained;  /* the consumer found the queue empty and holds no packet */
+  SDL_atomic_t got_size; /* totals of the packets taken or dropped, wrap around */
+  SDL_atomic_t got_duration;
+
+  /* shared accounting */
+  char pad2[CACHE_LINE_SIZE];
+  SDL_atomic_t nb_packets;
+  char pad3[CACHE_LINE_SIZE];
+} PacketQueue;
+
+int packet_queue_init(PacketQueue *q, AVRational time_base);
+void packet_queue_clear(PacketQueue *q);
+void packet_queue_destroy(PacketQueue *q);
+int packet_queue_put(struct VideoState *is, PacketQueue *q, AVPacket *pkt);
+int packet_queue_get(struct VideoState *is, PacketQueue *q, AVPacket *pkt, int block, int *serial);
+void packet_queue_flush(PacketQueue *q);
+void packet_queue_wake(PacketQueue *q);
+int packet_queue_serial(PacketQueue *q);
+int packet_queue_nb_packets(PacketQueue *q);
+int packet_queue_drained(PacketQueue *q);
+/* of the packets queued since the last flush, the older ones are dropped unread */
+int packet_queue_size(PacketQueue *q);
+int packet_queue_duration_ms(PacketQueue *q);
+
+#endif /* PACKET_QUEUE_H_ */
@@ -0,0 +1,195 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <libavutil/common.h>
+#include <libavutil/mem.h>
+
+#include <pcm_ring.h>
+
+/*
+ * The storage is kept for the lifetime of the player and only replaced by
+ * a larger one; a later init (after reset) rewinds the ring.
+ */
+int pcm_ring_init(PcmRing *r, unsigned int size) {
+  unsigned int capacity = 4096;
+
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+
+  if (!r->mutex) {
+    r->mutex = SDL_CreateMutex();
+    r->cond = SDL_CreateCond();
+  }
+
+  if (capacity > r->capacity) {
+    av_freep(&r->data);
+    r->capacity = 0;
+    r->data = av_malloc(capacity);
+    if (!r->data) {
+      return -1;
+    }
+    r->capacity = capacity;
+  }
+
+  pcm_ring_clear(r);
+  return 0;
+}
+
+/* Drop the queued samples, the threads using the ring have been joined */
+void pcm_ring_clear(PcmRing *r) {
+  SDL_AtomicSet(&r->windex, 0);
+  SDL_AtomicSet(&r->flush_index, 0);
+  SDL_AtomicSet(&r->producer_waiting, 0);
+  SDL_AtomicSet(&r->woken, 0);
+  SDL_AtomicSet(&r->rindex, 0);
+}
+
+void pcm_ring_destroy(PcmRing *r) {
+  if (!r->mutex) {
+    return;
+  }
+
+  av_freep(&r->data);
+  SDL_DestroyCond(r->cond);
+  SDL_DestroyMutex(r->mutex);
+  memset(r, 0, sizeof(PcmRing));
+}
+
+/* Index the consumer reads from next, past the bytes written before a flush */
+static unsigned int pcm_ring_rindex(PcmRing *r) {
+  unsigned int rindex = SDL_AtomicGet(&r->rindex);
+  unsigned int flush_index = SDL_AtomicGet(&r->flush_index);
+
+  if ((int) (flush_index - rindex) > 0) {
+    return flush_index;
+  }
+  return rindex;
+}
+
+/* Bytes queued for the consumer */
+int pcm_ring_fill(PcmRing *r) {
+  return (int) ((unsigned int) SDL_AtomicGet(&r->windex) - pcm_ring_rindex(r));
+}
+
+/* Called by the producer, returns how many bytes fit */
+int pcm_ring_write(PcmRing *r, const uint8_t *data, int size) {
+  unsigned int windex, offset, len1;
+
+  if (!r->data || size <= 0) {
+    return 0;
+  }
+
+  windex = SDL_AtomicGet(&r->windex);
+  size = FFMIN(size, (int) (r->capacity - (windex - (unsigned int) SDL_AtomicGet(&r->rindex))));
+  if (size <= 0) {
+    return 0;
+  }
+
+  offset = windex & (r->capacity - 1);
+  len1 = FFMIN((unsigned int) size, r->capacity - offset);
+  memcpy(r->data + offset, data, len1);
+  memcpy(r->data, data + len1, size - len1);
+
+  /* publish the bytes to the consumer */
+  SDL_AtomicSet(&r->windex, windex + size);
+  return size;
+}
+
+/*
+ * Called by the producer after a short write: sleeps until the consumer
+ * freed a quarter of the ring or pcm_ring_wake was called.
+ */
+void pcm_ring_wait(PcmRing *r) {
+  unsigned int free_size;
+
+  SDL_LockMutex(r->mutex);
+  SDL_AtomicSet(&r->producer_waiting, 1);
+  free_size = r->capacity - ((unsigned int) SDL_AtomicGet(&r->windex) - (unsigned int) SDL_AtomicGet(&r->rindex));
+  if (!SDL_AtomicGet(&r->woken) && free_size < r->capacity / 4) {
+    SDL_CondWait(r->cond, r->mutex);
+  }
+  SDL_AtomicSet(&r->producer_waiting, 0);
+  SDL_AtomicSet(&r->woken, 0);
+  SDL_UnlockMutex(r->mutex);
+}
+
+/* Wake a sleeping producer, e.g. after a seek or once quit is set */
+void pcm_ring_wake(PcmRing *r) {
+  if (!r->mutex) {
+    return;
+  }
+
+  SDL_LockMutex(r->mutex);
+  SDL_AtomicSet(&r->woken, 1);
+  SDL_CondSignal(r->cond);
+  SDL_UnlockMutex(r->mutex);
+}
+
+/*
+ * Called by the producer before it writes the first samples decoded after
+ * a seek. The bytes are still owned by the consumer, which skips what was
+ * written before on its next read.
+ */
+void pcm_ring_flush(PcmRing *r) {
+  SDL_AtomicSet(&r->flush_index, SDL_AtomicGet(&r->windex));
+}
+
+/* Release the bytes up to rindex, called by the consumer only */
+static void pcm_ring_release(PcmRing *r, unsigned int rindex) {
+  SDL_AtomicSet(&r->rindex, rindex);
+
+  if (SDL_AtomicGet(&r->producer_waiting)) {
+    SDL_LockMutex(r->mutex);
+    SDL_CondSignal(r->cond);
+    SDL_UnlockMutex(r->mutex);
+  }
+}
+
+/* Called by the consumer, returns how many bytes were copied to data */
+int pcm_ring_read(PcmRing *r, uint8_t *data, int size) {
+  unsigned int rindex, offset, len1;
+
+  if (!r->data || size <= 0) {
+    return 0;
+  }
+
+  rindex = pcm_ring_rindex(r);
+  size = FFMIN(size, (int) ((unsigned int) SDL_AtomicGet(&r->windex) - rindex));
+  if (size <= 0) {
+    return 0;
+  }
+
+  offset = rindex & (r->capacity - 1);
+  len1 = FFMIN((unsigned int) size, r->capacity - offset);
+  memcpy(data, r->data + offset, len1);
+  memcpy(data + len1, r->data, size - len1);
+
+  pcm_ring_release(r, rindex + size);
+  return size;
+}
+
+/* Called by the consumer, discards everything written so far */
+void pcm_ring_drop(PcmRing *r) {
+  if (!r->data) {
+    return;
+  }
+  pcm_ring_release(r, SDL_AtomicGet(&r->windex));
+}
@@ -0,0 +1,67 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PCM_RING_H_
+#define PCM_RING_H_
+
+#include <stdint.h>
+
+#include <SDL.h>
+#include <SDL_atomic.h>
+#include <SDL_thread.h>
+
+#include <packet_queue.h>
+
+/*
+ * Bounded single-producer/single-consumer byte ring of decoded PCM. The
+ * audio decode thread is the only producer and the audio output callback
+ * the only consumer; the indices count bytes and are advanced without a
+ * lock, the mutex is only taken by the producer to sleep while the ring
+ * is full and by the consumer to wake it.
+ */
+typedef struct PcmRing {
+  uint8_t *data;
+  unsigned int capacity;   /* bytes, a power of two */
+  SDL_mutex *mutex;
+  SDL_cond *cond;          /* signalled when space is released or on wake */
+
+  /* owned by the producer */
+  char pad0[CACHE_LINE_SIZE];
+  SDL_atomic_t windex;
+  SDL_atomic_t flush_index;  /* windex at the last flush, older bytes are stale */
+  SDL_atomic_t producer_waiting;
+  SDL_atomic_t woken;
+
+  /* owned by the consumer */
+  char pad1[CACHE_LINE_SIZE];
+  SDL_atomic_t rindex;
+  char pad2[CACHE_LINE_SIZE];
+} PcmRing;
+
+int pcm_ring_init(PcmRing *r, unsigned int size);
+void pcm_ring_clear(PcmRing *r);
+void pcm_ring_destroy(PcmRing *r);
+int pcm_ring_write(PcmRing *r, const uint8_t *data, int size);
+void pcm_ring_wait(PcmRing *r);
+void pcm_ring_wake(PcmRing *r);
+void pcm_ring_flush(PcmRing *r);
+int pcm_ring_read(PcmRing *r, uint8_t *data, int size);
+void pcm_ring_drop(PcmRing *r);
+int pcm_ring_fill(PcmRing *r);
+
+#endif /* PCM_RING_H_ */
@@ -0,0 +1,713 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include <libavutil/avstring.h>
+#include <libavutil/mem.h>
+#include <libavutil/md5.h>
+
+#include <ffmpeg_utils.h>
+#include <probe_cache.h>
+
+#define PROBE_CACHE_MAGIC 0x46504331 /* "FPC1", bump when the layout changes */
+#define PROBE_CACHE_SUFFIX ".probe"
+#define PROBE_CACHE_SEEK_INDEX_MAGIC 0x46534931 /* "FSI1" */
+#define PROBE_CACHE_SEEK_INDEX_SUFFIX ".seek"
+#define PROBE_CACHE_MAX_EXTRADATA (1024 * 1024)
+#define PROBE_CACHE_TMP_PREFIX "entry-"
+#define PROBE_CACHE_TMP_MAX_AGE 60 /* seconds, older temp files were left by a crash */
+
+int probe_cache_source_key(char *key, size_t size, const char *url, int fd,
+                           int64_t offset, int64_t length, int64_t io_size) {
+  struct stat st;
+
+  if (fd != -1) {
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+      return -1;
+    }
+    snprintf(key, size, "file:%" PRIu64 ":%" PRIu64 ":%" PRId64 ":%" PRId64 ":%" PRId64 ":%" PRId64,
+             (uint64_t) st.st_dev, (uint64_t) st.st_ino, (int64_t) st.st_size,
+             (int64_t) st.st_mtime, offset, length);
+    return 0;
+  }
+
+  if (io_size <= 0) {
+    return -1;
+  }
+  snprintf(key, size, "%s:%" PRId64, url, io_size);
+  return 0;
+}
+
+static void probe_cache_path(char *path, size_t size, const char *dir, const char *key,
+                             const char *suffix) {
+  uint8_t md5[16];
+  char hex[33];
+  int i;
+
+  av_md5_sum(md5, (const uint8_t *) key, strlen(key));
+  for (i = 0; i < 16; i++) {
+    snprintf(hex + i * 2, 3, "%02x", md5[i]);
+  }
+  snprintf(path, size, "%s/%s%s", dir, hex, suffix);
+}
+
+static int put_bytes(FILE *f, const void *buf, size_t size) {
+  return fwrite(buf, 1, size, f) == size ? 0 : -1;
+}
+
+static int put_i32(FILE *f, int32_t v) {
+  return put_bytes(f, &v, sizeof(v));
+}
+
+static int put_i64(FILE *f, int64_t v) {
+  return put_bytes(f, &v, sizeof(v));
+}
+
+static int put_str(FILE *f, const char *s) {
+  int32_t len = s ? (int32_t) strlen(s) : 0;
+  return put_i32(f, len) < 0 || put_bytes(f, s, len) < 0 ? -1 : 0;
+}
+
+static int get_bytes(FILE *f, void *buf, size_t size) {
+  return fread(buf, 1, size, f) == size ? 0 : -1;
+}
+
+static int get_i32(FILE *f, int32_t *v) {
+  return get_bytes(f, v, sizeof(*v));
+}
+
+static int get_i64(FILE *f, int64_t *v) {
+  return get_bytes(f, v, sizeof(*v));
+}
+
+/* Reads a string written by put_str into an allocated buffer */
+static char *get_str(FILE *f) {
+  int32_t len;
+  char *s;
+
+  if (get_i32(f, &len) < 0 || len < 0 || len > PROBE_CACHE_KEY_SIZE) {
+    return NULL;
+  }
+  s = av_malloc(len + 1);
+  if (!s || get_bytes(f, s, len) < 0) {
+    av_free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+static int put_codecpar(FILE *f, const AVCodecParameters *par) {
+  if (put_i32(f, par->codec_type) < 0 ||
+      put_i32(f, par->codec_id) < 0 ||
+      put_i32(f, par->codec_tag) < 0 ||
+      put_i32(f, par->format) < 0 ||
+      put_i64(f, par->bit_rate) < 0 ||
+      put_i32(f, par->bits_per_coded_sample) < 0 ||
+      put_i32(f, par->bits_per_raw_sample) < 0 ||
+      put_i32(f, par->profile) < 0 ||
+      put_i32(f, par->level) < 0 ||
+      put_i32(f, par->width) < 0 ||
+      put_i32(f, par->height) < 0 ||
+      put_i32(f, par->sample_aspect_ratio.num) < 0 ||
+      put_i32(f, par->sample_aspect_ratio.den) < 0 ||
+      put_i32(f, par->field_order) < 0 ||
+      put_i32(f, par->color_range) < 0 ||
+      put_i32(f, par->color_primaries) < 0 ||
+      put_i32(f, par->color_trc) < 0 ||
+      put_i32(f, par->color_space) < 0 ||
+      put_i32(f, par->chroma_location) < 0 ||
+      put_i32(f, par->video_delay) < 0 ||
+      put_i64(f, (int64_t) par->channel_layout) < 0 ||
+      put_i32(f, par->channels) < 0 ||
+      put_i32(f, par->sample_rate) < 0 ||
+      put_i32(f, par->block_align) < 0 ||
+      put_i32(f, par->frame_size) < 0 ||
+      put_i32(f, par->initial_padding) < 0 ||
+      put_i32(f, par->seek_preroll) < 0 ||
+      put_i32(f, par->extradata_size) < 0 ||
+      put_bytes(f, par->extradata, par->extradata_size) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int get_codecpar(FILE *f, AVCodecParameters *par) {
+  int32_t v[27];
+  int64_t bit_rate, channel_layout;
+  int i = 0;
+
+  if (get_i32(f, &v[i++]) < 0 ||   /* codec_type */
+      get_i32(f, &v[i++]) < 0 ||   /* codec_id */
+      get_i32(f, &v[i++]) < 0 ||   /* codec_tag */
+      get_i32(f, &v[i++]) < 0 ||   /* format */
+      get_i64(f, &bit_rate) < 0) {
+    return -1;
+  }
+  /* bits_per_coded_sample up to video_delay */
+  for (; i < 19; i++) {
+    if (get_i32(f, &v[i]) < 0) {
+      return -1;
+    }
+  }
+  if (get_i64(f, &channel_layout) < 0) {
+    return -1;
+  }
+  /* channels up to extradata_size */
+  for (; i < 26; i++) {
+    if (get_i32(f, &v[i]) < 0) {
+      return -1;
+    }
+  }
+
+  par->codec_type = v[0];
+  par->codec_id = v[1];
+  par->codec_tag = v[2];
+  par->format = v[3];
+  par->bit_rate = bit_rate;
+  par->bits_per_coded_sample = v[4];
+  par->bits_per_raw_sample = v[5];
+  par->profile = v[6];
+  par->level = v[7];
+  par->width = v[8];
+  par->height = v[9];
+  par->sample_aspect_ratio.num = v[10];
+  par->sample_aspect_ratio.den = v[11];
+  par->field_order = v[12];
+  par->color_range = v[13];
+  par->color_primaries = v[14];
+  par->color_trc = v[15];
+  par->color_space = v[16];
+  par->chroma_location = v[17];
+  par->video_delay = v[18];
+  par->channel_layout = (uint64_t) channel_layout;
+  par->channels = v[19];
+  par->sample_rate = v[20];
+  par->block_align = v[21];
+  par->frame_size = v[22];
+  par->initial_padding = v[23];
+  par->seek_preroll = v[24];
+
+  if (v[25] < 0 || v[25] > PROBE_CACHE_MAX_EXTRADATA) {
+    return -1;
+  }
+  if (v[25] > 0) {
+    par->extradata = av_mallocz(v[25] + AV_INPUT_BUFFER_PADDING_SIZE);
+    if (!par->extradata) {
+      return -1;
+    }
+    par->extradata_size = v[25];
+    if (get_bytes(f, par->extradata, par->extradata_size) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void probe_cache_free(ProbeCacheEntry **pentry) {
+  ProbeCacheEntry *entry = *pentry;
+  unsigned int i;
+
+  if (!entry) {
+    return;
+  }
+
+  if (entry->codecpar) {
+    for (i = 0; i < entry->nb_streams; i++) {
+      avcodec_parameters_free(&entry->codecpar[i]);
+    }
+  }
+  av_freep(&entry->codecpar);
+  av_freep(&entry->avg_frame_rate);
+  av_freep(&entry->r_frame_rate);
+  av_dict_free(&entry->metadata);
+  av_freep(pentry);
+}
+
+/* Checks the header written by put_header */
+static int get_header(FILE *f, int32_t magic, const char *key) {
+  int32_t stored_magic;
+  char *stored_key;
+  int ret;
+
+  if (get_i32(f, &stored_magic) < 0 || stored_magic != magic) {
+    return -1;
+  }
+
+  /* two sources whose keys have the same hash */
+  stored_key = get_str(f);
+  ret = !stored_key || strcmp(stored_key, key) ? -1 : 0;
+  av_free(stored_key);
+  return ret;
+}
+
+static int put_header(FILE *f, int32_t magic, const char *key) {
+  return put_i32(f, magic) < 0 || put_str(f, key) < 0 ? -1 : 0;
+}
+
+static int probe_cache_read(FILE *f, const char *key, ProbeCacheEntry *entry) {
+  int32_t nb_streams, nb_metadata;
+  char *name, *value;
+  unsigned int i;
+
+  if (get_header(f, PROBE_CACHE_MAGIC, key) < 0) {
+    return -1;
+  }
+
+  name = get_str(f);
+  if (!name) {
+    return -1;
+  }
+  av_strlcpy(entry->format_name, name, sizeof(entry->format_name));
+  av_free(name);
+
+  if (get_i64(f, &entry->duration) < 0 ||
+      get_i64(f, &entry->start_time) < 0 ||
+      get_i64(f, &entry->bit_rate) < 0 ||
+      get_i32(f, &nb_streams) < 0 || nb_streams <= 0 || nb_streams > 64) {
+    return -1;
+  }
+
+  entry->codecpar = av_mallocz_array(nb_streams, sizeof(*entry->codecpar));
+  entry->avg_frame_rate = av_mallocz_array(nb_streams, sizeof(*entry->avg_frame_rate));
+  entry->r_frame_rate = av_mallocz_array(nb_streams, sizeof(*entry->r_frame_rate));
+  if (!entry->codecpar || !entry->avg_frame_rate || !entry->r_frame_rate) {
+    return -1;
+  }
+  entry->nb_streams = nb_streams;
+
+  for (i = 0; i < entry->nb_streams; i++) {
+    entry->codecpar[i] = avcodec_parameters_alloc();
+    if (!entry->codecpar[i] ||
+        get_codecpar(f, entry->codecpar[i]) < 0 ||
+        get_i32(f, &entry->avg_frame_rate[i].num) < 0 ||
+        get_i32(f, &entry->avg_frame_rate[i].den) < 0 ||
+        get_i32(f, &entry->r_frame_rate[i].num) < 0 ||
+        get_i32(f, &entry->r_frame_rate[i].den) < 0) {
+      return -1;
+    }
+  }
+
+  if (get_i32(f, &nb_metadata) < 0 || nb_metadata < 0) {
+    return -1;
+  }
+  for (i = 0; i < (unsigned int) nb_metadata; i++) {
+    name = get_str(f);
+    value = name ? get_str(f) : NULL;
+    if (!value) {
+      av_free(name);
+      return -1;
+    }
+    av_dict_set(&entry->metadata, name, value, AV_DICT_DONT_STRDUP_KEY | AV_DICT_DONT_STRDUP_VAL);
+  }
+  return 0;
+}
+
+ProbeCacheEntry *probe_cache_lookup(const char *dir, const char *key) {
+  char path[1024];
+  ProbeCacheEntry *entry;
+  FILE *f;
+
+  if (!dir || !dir[0] || !key) {
+    return NULL;
+  }
+
+  probe_cache_path(path, sizeof(path), dir, key, PROBE_CACHE_SUFFIX);
+  f = fopen(path, "rb");
+  if (!f) {
+    return NULL;
+  }
+
+  entry = av_mallocz(sizeof(ProbeCacheEntry));
+  if (!entry || probe_cache_read(f, key, entry) < 0) {
+    probe_cache_free(&entry);
+    fclose(f);
+    return NULL;
+  }
+  fclose(f);
+
+  /* the modification time orders the entries for eviction */
+  utime(path, NULL);
+  return entry;
+}
+
+int probe_cache_apply(ProbeCacheEntry *entry, AVFormatContext *ic) {
+  unsigned int i;
+
+  if (ic->nb_streams != entry->nb_streams) {
+    return -1;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVCodecParameters *par = ic->streams[i]->codecpar;
+    if (par->codec_type != entry->codecpar[i]->codec_type ||
+        (par->codec_id != AV_CODEC_ID_NONE && par->codec_id != entry->codecpar[i]->codec_id)) {
+      return -1;
+    }
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+
+    if (avcodec_parameters_copy(st->codecpar, entry->codecpar[i]) < 0 ||
+        avcodec_parameters_to_context(st->codec, st->codecpar) < 0) {
+      return -1;
+    }
+    if (!st->avg_frame_rate.num) {
+      st->avg_frame_rate = entry->avg_frame_rate[i];
+    }
+    if (!st->r_frame_rate.num) {
+      st->r_frame_rate = entry->r_frame_rate[i];
+    }
+  }
+
+  if (ic->duration == AV_NOPTS_VALUE) {
+    ic->duration = entry->duration;
+  }
+  if (ic->start_time == AV_NOPTS_VALUE) {
+    ic->start_time = entry->start_time;
+  }
+  if (!ic->bit_rate) {
+    ic->bit_rate = entry->bit_rate;
+  }
+  av_dict_copy(&ic->metadata, entry->metadata, AV_DICT_DONT_OVERWRITE);
+  return 0;
+}
+
+typedef struct ProbeCacheFile {
+  char name[64];
+  off_t size;
+  time_t mtime;
+} ProbeCacheFile;
+
+static int probe_cache_file_cmp(const void *a, const void *b) {
+  time_t ta = ((const ProbeCacheFile *) a)->mtime;
+  time_t tb = ((const ProbeCacheFile *) b)->mtime;
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Delete the least recently used entries until the directory fits max_bytes */
+static void probe_cache_trim(const char *dir, int64_t max_bytes) {
+  ProbeCacheFile *files = NULL, *tmp;
+  int nb_files = 0, allocated = 0, i;
+  int64_t total = 0;
+  char path[1024];
+  struct dirent *de;
+  struct stat st;
+  DIR *d;
+
+  d = opendir(dir);
+  if (!d) {
+    return;
+  }
+
+  while ((de = readdir(d))) {
+    if (av_strstart(de->d_name, PROBE_CACHE_TMP_PREFIX, NULL)) {
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      if (stat(path, &st) == 0 && time(NULL) - st.st_mtime > PROBE_CACHE_TMP_MAX_AGE) {
+        unlink(path);
+      }
+      continue;
+    }
+    /* PROBE_CACHE_SUFFIX and PROBE_CACHE_SEEK_INDEX_SUFFIX */
+    if (!av_match_ext(de->d_name, "probe,seek") ||
+        strlen(de->d_name) >= sizeof(files->name)) {
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+    if (stat(path, &st) < 0) {
+      continue;
+    }
+    if (nb_files == allocated) {
+      allocated = allocated ? allocated * 2 : 32;
+      tmp = av_realloc_array(files, allocated, sizeof(*files));
+      if (!tmp) {
+        break;
+      }
+      files = tmp;
+    }
+    av_strlcpy(files[nb_files].name, de->d_name, sizeof(files->name));
+    files[nb_files].size = st.st_size;
+    files[nb_files].mtime = st.st_mtime;
+    total += st.st_size;
+    nb_files++;
+  }
+  closedir(d);
+
+  if (total > max_bytes) {
+    qsort(files, nb_files, sizeof(*files), probe_cache_file_cmp);
+    for (i = 0; i < nb_files && total > max_bytes; i++) {
+      snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+      if (unlink(path) == 0) {
+        total -= files[i].size;
+      }
+    }
+  }
+  av_free(files);
+}
+
+static int probe_cache_write(FILE *f, const char *key, void *opaque) {
+  /* player metadata set from the analyzed streams, restored on a hit */
+  const char *metadata_keys[] = { ROTATE, FRAMERATE, CHAPTER_COUNT };
+  AVFormatContext *ic = opaque;
+  AVDictionaryEntry *tag;
+  int32_t nb_metadata = 0;
+  unsigned int i;
+
+  if (put_header(f, PROBE_CACHE_MAGIC, key) < 0 ||
+      put_str(f, ic->iformat->name) < 0 ||
+      put_i64(f, ic->duration) < 0 ||
+      put_i64(f, ic->start_time) < 0 ||
+      put_i64(f, ic->bit_rate) < 0 ||
+      put_i32(f, ic->nb_streams) < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < ic->nb_streams; i++) {
+    AVStream *st = ic->streams[i];
+    if (put_codecpar(f, st->codecpar) < 0 ||
+        put_i32(f, st->avg_frame_rate.num) < 0 ||
+        put_i32(f, st->avg_frame_rate.den) < 0 ||
+        put_i32(f, st->r_frame_rate.num) < 0 ||
+        put_i32(f, st->r_frame_rate.den) < 0) {
+      return -1;
+    }
+  }
+
+  for (i = 0; i < FF_ARRAY_ELEMS(metadata_keys); i++) {
+    if (av_dict_get(ic->metadata, metadata_keys[i], NULL, AV_DICT_MATCH_CASE)) {
+      nb_metadata++;
+    }
+  }
+  if (put_i32(f, nb_metadata) < 0) {
+    return -1;
+  }
+  for (i = 0; i < FF_ARRAY_ELEMS(metadata_keys); i++) {
+    tag = av_dict_get(ic->metadata, metadata_keys[i], NULL, AV_DICT_MATCH_CASE);
+    if (tag && (put_str(f, tag->key) < 0 || put_str(f, tag->value) < 0)) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Writes the file of key with suffix and trims the directory */
+static int probe_cache_write_file(const char *dir, const char *key, const char *suffix,
+                                  int (*write)(FILE *f, const char *key, void *opaque),
+                                  void *opaque, int64_t max_bytes) {
+  char path[1024], tmp_path[1024];
+  FILE *f;
+  int fd, ret;
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST) {
+    return -1;
+  }
+
+  /* written aside and renamed, so a reader never sees a partial entry */
+  snprintf(tmp_path, sizeof(tmp_path), "%s/" PROBE_CACHE_TMP_PREFIX "XXXXXX", dir);
+  fd = mkstemp(tmp_path);
+  if (fd < 0) {
+    return -1;
+  }
+  f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  ret = write(f, key, opaque);
+  if (fclose(f) != 0) {
+    ret = -1;
+  }
+
+  probe_cache_path(path, sizeof(path), dir, key, suffix);
+  if (ret < 0 || rename(tmp_path, path) < 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+
+  probe_cache_trim(dir, max_bytes);
+  return 0;
+}
+
+int probe_cache_store(const char *dir, const char *key, AVFormatContext *ic, int64_t max_bytes) {
+  if (!dir || !dir[0] || !key || !ic->iformat || !ic->nb_streams) {
+    return -1;
+  }
+  /*
+   * Formats without a header, e.g. mpegts, find their streams while reading
+   * packets. The streams of a new open never match the entry, so it would
+   * be removed and written again on every prepare.
+   */
+  if (ic->ctx_flags & AVFMTCTX_NOHEADER) {
+    return -1;
+  }
+
+  return probe_cache_write_file(dir, key, PROBE_CACHE_SUFFIX, probe_cache_write, ic, max_bytes);
+}
+
+typedef struct SeekIndexList {
+  SeekIndex *indexes;
+  int nb_indexes;
+} SeekIndexList;
+
+static int probe_cache_write_seek_index(FILE *f, const char *key, void *opaque) {
+  SeekIndexList *list = opaque;
+  SeekIndex *index;
+  int32_t nb_indexes = 0;
+  int i, j;
+
+  for (i = 0; i < list->nb_indexes; i++) {
+    if (list->indexes[i].nb_entries) {
+      nb_indexes++;
+    }
+  }
+  if (put_header(f, PROBE_CACHE_SEEK_INDEX_MAGIC, key) < 0 ||
+      put_i32(f, nb_indexes) < 0) {
+    return -1;
+  }
+
+  for (i = 0; i < list->nb_indexes; i++) {
+    index = &list->indexes[i];
+    if (!index->nb_entries) {
+      continue;
+    }
+    if (put_i32(f, index->stream_index) < 0 ||
+        put_i32(f, index->time_base.num) < 0 ||
+        put_i32(f, index->time_base.den) < 0 ||
+        put_i32(f, index->nb_entries) < 0) {
+      return -1;
+    }
+    for (j = 0; j < index->nb_entries; j++) {
+      if (put_i64(f, index->entries[j].pts) < 0 ||
+          put_i64(f, index->entries[j].pos) < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+int probe_cache_store_seek_index(const char *dir, const char *key, SeekIndex *indexes,
+                                 int nb_indexes, int64_t max_bytes) {
+  SeekIndexList list = { indexes, nb_indexes };
+
+  if (!dir || !dir[0] || !key || !key[0]) {
+    return -1;
+  }
+
+  return probe_cache_write_file(dir, key, PROBE_CACHE_SEEK_INDEX_SUFFIX,
+                                probe_cache_write_seek_index, &list, max_bytes);
+}
+
+static int probe_cache_read_seek_index(FILE *f, const char *key, SeekIndex *indexes,
+                                       int nb_indexes) {
+  int32_t nb_stored, stream_index, num, den, nb_entries;
+  int64_t pts, pos;
+  SeekIndex *index;
+  int i, j;
+
+  if (get_header(f, PROBE_CACHE_SEEK_INDEX_MAGIC, key) < 0 ||
+      get_i32(f, &nb_stored) < 0 || nb_stored < 0 || nb_stored > 64) {
+    return -1;
+  }
+
+  for (i = 0; i < nb_stored; i++) {
+    if (get_i32(f, &stream_index) < 0 ||
+        get_i32(f, &num) < 0 ||
+        get_i32(f, &den) < 0 ||
+        get_i32(f, &nb_entries) < 0 ||
+        nb_entries < 0 || nb_entries > SEEK_INDEX_MAX_ENTRIES) {
+      return -1;
+    }
+
+    /* only streams the player opened the same way */
+    index = NULL;
+    for (j = 0; j < nb_indexes; j++) {
+      if (indexes[j].time_base.den && indexes[j].stream_index == stream_index &&
+          indexes[j].time_base.num == num && indexes[j].time_base.den == den) {
+        index = &indexes[j];
+      }
+    }
+
+    for (j = 0; j < nb_entries; j++) {
+      if (get_i64(f, &pts) < 0 || get_i64(f, &pos) < 0) {
+        return -1;
+      }
+      if (index) {
+        seek_index_add(index, pts, pos);
+      }
+    }
+  }
+  return 0;
+}
+
+int probe_cache_load_seek_index(const char *dir, const char *key, SeekIndex *indexes,
+                                int nb_indexes) {
+  char path[1024];
+  FILE *f;
+  int i, ret;
+
+  if (!dir || !dir[0] || !key || !key[0]) {
+    return -1;
+  }
+
+  probe_cache_path(path, sizeof(path), dir, key, PROBE_CACHE_SEEK_INDEX_SUFFIX);
+  f = fopen(path, "rb");
+  if (!f) {
+    return -1;
+  }
+  ret = probe_cache_read_seek_index(f, key, indexes, nb_indexes);
+  fclose(f);
+
+  /* what was just loaded does not need to be written back */
+  for (i = 0; i < nb_indexes; i++) {
+    indexes[i].dirty = 0;
+  }
+  if (ret < 0) {
+    unlink(path);
+    return -1;
+  }
+
+  utime(path, NULL);
+  return 0;
+}
+
+void probe_cache_remove(const char *dir, const char *key) {
+  char path[1024];
+
+  if (!dir || !dir[0] || !key) {
+    return;
+  }
+
+  probe_cache_path(path, sizeof(path), dir, key, PROBE_CACHE_SUFFIX);
+  unlink(path);
+  probe_cache_path(path, sizeof(path), dir, key, PROBE_CACHE_SEEK_INDEX_SUFFIX);
+  unlink(path);
+}
@@ -0,0 +1,76 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROBE_CACHE_H_
+#define PROBE_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+#include <seek_index.h>
+
+#define PROBE_CACHE_DEFAULT_MAX_BYTES (1024 * 1024)
+#define PROBE_CACHE_KEY_SIZE 1280
+
+/*
+ * What avformat_find_stream_info found for a source, stored in a directory
+ * with one file per source. A prepare that finds an entry opens the input
+ * with the cached format and takes the stream parameters from the entry
+ * instead of analyzing the streams again. The least recently used entries
+ * are deleted once the directory grows past its size limit.
+ */
+typedef struct ProbeCacheEntry {
+  char format_name[64];
+  int64_t duration;
+  int64_t start_time;
+  int64_t bit_rate;
+  unsigned int nb_streams;
+  AVCodecParameters **codecpar;
+  AVRational *avg_frame_rate;
+  AVRational *r_frame_rate;
+  AVDictionary *metadata;    /* player metadata derived from the streams */
+} ProbeCacheEntry;
+
+/*
+ * Identity of a source: device, inode, size and modification time of a file
+ * descriptor, or the URL and its size. Returns -1 if the source cannot be
+ * identified, e.g. a live stream of unknown size.
+ */
+int probe_cache_source_key(char *key, size_t size, const char *url, int fd,
+                           int64_t offset, int64_t length, int64_t io_size);
+
+ProbeCacheEntry *probe_cache_lookup(const char *dir, const char *key);
+/* Returns -1 if the streams of ic do not match the entry */
+int probe_cache_apply(ProbeCacheEntry *entry, AVFormatContext *ic);
+int probe_cache_store(const char *dir, const char *key, AVFormatContext *ic, int64_t max_bytes);
+void probe_cache_remove(const char *dir, const char *key);
+
+/*
+ * The keyframe indexes of a source are kept in a second file next to its
+ * entry and evicted with the other files of the directory. Loading adds
+ * the stored entries of the streams whose index and time base match.
+ */
+int probe_cache_load_seek_index(const char *dir, const char *key, SeekIndex *indexes,
+                                int nb_indexes);
+int probe_cache_store_seek_index(const char *dir, const char *key, SeekIndex *indexes,
+                                 int nb_indexes, int64_t max_bytes);
+void probe_cache_free(ProbeCacheEntry **entry);
+
+#endif /* PROBE_CACHE_H_ */
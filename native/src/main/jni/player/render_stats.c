@@ -0,0 +1,80 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include <libavutil/time.h>
+
+#include <render_stats.h>
+
+static const char *render_stage_names[RENDER_STAGE_NB] = {
+  "demux",
+  "audio decode",
+  "video decode",
+  "video convert",
+};
+
+static int64_t thread_cpu_time(void) {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0) {
+    return 0;
+  }
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void render_clock_start(RenderClock *clock) {
+  clock->wall = av_gettime_relative();
+  clock->cpu = thread_cpu_time();
+}
+
+void render_stage_add(RenderStage *stage, RenderClock *clock, int frames) {
+  stage->wall += av_gettime_relative() - clock->wall;
+  stage->cpu += thread_cpu_time() - clock->cpu;
+  stage->frames += frames;
+}
+
+int render_stage_value(RenderStage *stage, int stat) {
+  switch (stat) {
+  case RENDER_STAT_WALL_MS:
+    return (int) (stage->wall / 1000);
+  case RENDER_STAT_CPU_MS:
+    return (int) (stage->cpu / 1000);
+  case RENDER_STAT_FPS:
+    return stage->wall > 0 ? (int) (stage->frames * 1000000 / stage->wall) : 0;
+  default:
+    return -1;
+  }
+}
+
+void render_stages_log(RenderStage *stages, int64_t wall, const char *filename) {
+  int i;
+
+  fprintf(stderr, "Rendered %s in %d ms\n", filename, (int) (wall / 1000));
+  for (i = 0; i < RENDER_STAGE_NB; i++) {
+    if (!stages[i].frames) {
+      continue;
+    }
+    fprintf(stderr, "  %s: %lld frames, wall %d ms, cpu %d ms, %d fps\n", render_stage_names[i],
+            (long long) stages[i].frames,
+            render_stage_value(&stages[i], RENDER_STAT_WALL_MS),
+            render_stage_value(&stages[i], RENDER_STAT_CPU_MS),
+            render_stage_value(&stages[i], RENDER_STAT_FPS));
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef RENDER_STATS_H_
+#define RENDER_STATS_H_
+
+#include <stdint.h>
+
+/* stages of the pipeline timed in offline render mode */
+enum render_stage {
+  RENDER_STAGE_DEMUX = 0,          // av_read_frame, per packet
+  RENDER_STAGE_AUDIO_DECODE = 1,   // avcodec_decode_audio4 and resampling, per frame
+  RENDER_STAGE_VIDEO_DECODE = 2,   // avcodec_decode_video2, per frame
+  RENDER_STAGE_VIDEO_CONVERT = 3,  // updateBmp, per frame
+  RENDER_STAGE_NB
+};
+
+/* values of each stage, in the order of its KEY_PARAMETER_RENDER_* keys */
+enum render_stat {
+  RENDER_STAT_WALL_MS = 0,
+  RENDER_STAT_CPU_MS = 1,
+  RENDER_STAT_FPS = 2,
+  RENDER_STAT_NB
+};
+
+/*
+ * Time spent in one stage. Each stage runs on a single thread, so the
+ * CPU time is that of the calling thread and does not include the other
+ * stages running meanwhile.
+ */
+typedef struct RenderStage {
+  int64_t wall;     /* us */
+  int64_t cpu;      /* us */
+  int64_t frames;
+} RenderStage;
+
+typedef struct RenderClock {
+  int64_t wall;
+  int64_t cpu;
+} RenderClock;
+
+void render_clock_start(RenderClock *clock);
+/* Adds the time since render_clock_start and frames to the stage */
+void render_stage_add(RenderStage *stage, RenderClock *clock, int frames);
+int render_stage_value(RenderStage *stage, int stat);
+void render_stages_log(RenderStage *stages, int64_t wall, const char *filename);
+
+#endif /* RENDER_STATS_H_ */
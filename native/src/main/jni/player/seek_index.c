@@ -0,0 +1,115 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <libavutil/mem.h>
+#include <libavutil/mathematics.h>
+
+#include <seek_index.h>
+
+void seek_index_init(SeekIndex *index, int stream_index, AVRational time_base) {
+  AVRational ms = { 1, 1000 };
+
+  seek_index_free(index);
+  index->stream_index = stream_index;
+  index->time_base = time_base;
+  index->min_distance = av_rescale_q(SEEK_INDEX_MIN_DISTANCE_MS, ms, time_base);
+  index->max_gap = av_rescale_q(SEEK_INDEX_MAX_GAP_MS, ms, time_base);
+}
+
+/* Index of the first entry after pts */
+static int seek_index_upper_bound(SeekIndex *index, int64_t pts) {
+  int lo = 0, hi = index->nb_entries, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (index->entries[mid].pts <= pts) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+/*
+ * Packets mostly arrive in order and are appended; after a backward seek
+ * the keyframes read again are already recorded and skipped.
+ */
+int seek_index_add(SeekIndex *index, int64_t pts, int64_t pos) {
+  SeekIndexEntry *entries;
+  int i;
+
+  if (!index->time_base.den || pts == AV_NOPTS_VALUE || pos < 0) {
+    return -1;
+  }
+
+  i = seek_index_upper_bound(index, pts);
+  if ((i > 0 && pts - index->entries[i - 1].pts < index->min_distance) ||
+      (i < index->nb_entries && index->entries[i].pts - pts < index->min_distance)) {
+    return 0;
+  }
+
+  if (index->nb_entries >= SEEK_INDEX_MAX_ENTRIES) {
+    return -1;
+  }
+  if (index->nb_entries == index->allocated) {
+    int allocated = index->allocated ? index->allocated * 2 : 256;
+    entries = av_realloc_array(index->entries, allocated, sizeof(*entries));
+    if (!entries) {
+      return -1;
+    }
+    index->entries = entries;
+    index->allocated = allocated;
+  }
+
+  memmove(&index->entries[i + 1], &index->entries[i],
+          (index->nb_entries - i) * sizeof(*index->entries));
+  index->entries[i].pts = pts;
+  index->entries[i].pos = pos;
+  index->nb_entries++;
+  index->dirty = 1;
+  return 0;
+}
+
+int seek_index_lookup(SeekIndex *index, int64_t pts, SeekIndexEntry *entry) {
+  int i;
+
+  if (!index->nb_entries || pts == AV_NOPTS_VALUE) {
+    return -1;
+  }
+
+  i = seek_index_upper_bound(index, pts);
+  if (i == 0) {
+    return -1;
+  }
+  /* past the last entry nothing says how far the next keyframe is */
+  if (index->entries[i - 1].pts != pts &&
+      (i == index->nb_entries || index->entries[i].pts - index->entries[i - 1].pts > index->max_gap)) {
+    return -1;
+  }
+
+  *entry = index->entries[i - 1];
+  return 0;
+}
+
+void seek_index_free(SeekIndex *index) {
+  av_freep(&index->entries);
+  memset(index, 0, sizeof(SeekIndex));
+}
@@ -0,0 +1,59 @@
+/*
+ * FFmpegMediaPlayer: A unified interface for playing audio files and streams.
+ *
+ * Copyright 2016 William Seemann
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEEK_INDEX_H_
+#define SEEK_INDEX_H_
+
+#include <stdint.h>
+
+#include <libavformat/avformat.h>
+
+/* media time between two recorded keyframes and the most a seek may span */
+#define SEEK_INDEX_MIN_DISTANCE_MS 1000
+#define SEEK_INDEX_MAX_GAP_MS 30000
+#define SEEK_INDEX_MAX_ENTRIES (1 << 16)
+
+typedef struct SeekIndexEntry {
+  int64_t pts;    /* in the stream time base */
+  int64_t pos;    /* byte position of the keyframe packet */
+} SeekIndexEntry;
+
+/*
+ * Keyframes of one stream as the demuxer read them, sorted by pts. A seek
+ * target is only looked up between two entries at most max_gap apart, so
+ * the demuxer never reads more than that past the entry it jumps to; a
+ * range skipped by an earlier seek usually leaves a larger gap.
+ */
+typedef struct SeekIndex {
+  SeekIndexEntry *entries;
+  int nb_entries;
+  int allocated;
+  int stream_index;
+  AVRational time_base;
+  int64_t min_distance;   /* SEEK_INDEX_MIN_DISTANCE_MS in time_base */
+  int64_t max_gap;        /* SEEK_INDEX_MAX_GAP_MS in time_base */
+  int dirty;              /* entries added since the index was loaded */
+} SeekIndex;
+
+void seek_index_init(SeekIndex *index, int stream_index, AVRational time_base);
+int seek_index_add(SeekIndex *index, int64_t pts, int64_t pos);
+/* Returns -1 unless the entries around pts were read contiguously */
+int seek_index_lookup(SeekIndex *index, int64_t pts, SeekIndexEntry *entry);
+void seek_index_free(SeekIndex *index);
+
+#endif /* SEEK_INDEX_H_ */
@@ -55,17 +55,14 @@ struct SwsContext *createScaler(VideoPlayer **ps, AVCodecContext *codec) {
 void *createBmp(VideoPlayer **ps, int width, int height) {
 	VideoPlayer *is = *ps;
 
-	return malloc(sizeof(Picture));
+	return calloc(1, sizeof(Picture));
 }
 
 void destroyBmp(VideoPlayer **ps, void *bmp) {
 	Picture *picture = (Picture *) bmp;
 
 	if (picture) {
-		if (picture->buffer) {
-			free(picture->buffer);
-			picture->buffer = NULL;
-		}
+		av_freep(&picture->buffer);
 
 		free(picture);
 		picture = NULL;
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 #include "jni.h"
 #include "Errors.h"  // for int
 
@@ -46,6 +47,8 @@ struct fields_t {
     jfieldID    surface_texture;
     
     jmethodID   post_event;
+    jmethodID   post_render_audio;
+    jmethodID   post_render_video;
 };
 static fields_t fields;
 
@@ -54,12 +57,14 @@ static JavaVM *m_vm;
 
 // ----------------------------------------------------------------------------
 // ref-counted object for callbacks
-class JNIMediaPlayerListener: public MediaPlayerListener
+class JNIMediaPlayerListener: public MediaPlayerListener, public MediaRenderListener
 {
 public:
     JNIMediaPlayerListener(JNIEnv* env, jobject thiz, jobject weak_thiz);
     ~JNIMediaPlayerListener();
     virtual void notify(int msg, int ext1, int ext2, int from_thread);
+    virtual void renderAudio(const uint8_t *pcm, int len);
+    virtual void renderVideo(const uint8_t *rgba, int linesize, int width, int height, double pts);
     //virtual void notify(int msg, int ext1, int ext2, const Parcel *obj = NULL);
 private:
     JNIMediaPlayerListener();
@@ -152,6 +157,75 @@ void JNIMediaPlayerListener::notify(int msg, int ext1, int ext2, int fromThread)
     }
 }
 
+static pthread_key_t sRenderThreadKey;
+static pthread_once_t sRenderThreadOnce = PTHREAD_ONCE_INIT;
+
+static void detachRenderThread(void *env)
+{
+    m_vm->DetachCurrentThread();
+}
+
+static void createRenderThreadKey()
+{
+    pthread_key_create(&sRenderThreadKey, detachRenderThread);
+}
+
+// The render callbacks come once per frame, so unlike notify a render thread
+// is attached on its first callback and detached when it exits.
+static JNIEnv *getRenderThreadEnv()
+{
+    JNIEnv *env = 0;
+
+    if (m_vm->GetEnv((void**)&env, JNI_VERSION_1_6) == JNI_OK) {
+        return env;
+    }
+    if (m_vm->AttachCurrentThread(&env, NULL) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "failed to attach render thread");
+        return 0;
+    }
+    pthread_once(&sRenderThreadOnce, createRenderThreadKey);
+    pthread_setspecific(sRenderThreadKey, env);
+    return env;
+}
+
+// The buffers are wrapped, not copied, and only valid during the call.
+void JNIMediaPlayerListener::renderAudio(const uint8_t *pcm, int len)
+{
+    JNIEnv *env = getRenderThreadEnv();
+    if (env == 0) {
+        return;
+    }
+
+    jobject buffer = env->NewDirectByteBuffer((void *) pcm, len);
+    if (buffer != NULL) {
+        env->CallStaticVoidMethod(mClass, fields.post_render_audio, mObject, buffer);
+        env->DeleteLocalRef(buffer);
+    }
+    if (env->ExceptionCheck()) {
+        __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "An exception occurred while rendering audio.");
+        env->ExceptionClear();
+    }
+}
+
+void JNIMediaPlayerListener::renderVideo(const uint8_t *rgba, int linesize, int width, int height, double pts)
+{
+    JNIEnv *env = getRenderThreadEnv();
+    if (env == 0) {
+        return;
+    }
+
+    jobject buffer = env->NewDirectByteBuffer((void *) rgba, (jlong) linesize * height);
+    if (buffer != NULL) {
+        env->CallStaticVoidMethod(mClass, fields.post_render_video, mObject, buffer,
+                                  width, height, linesize, (jlong) (pts * 1000000));
+        env->DeleteLocalRef(buffer);
+    }
+    if (env->ExceptionCheck()) {
+        __android_log_print(ANDROID_LOG_WARN, LOG_TAG, "An exception occurred while rendering video.");
+        env->ExceptionClear();
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 static MediaPlayer* getMediaPlayer(JNIEnv* env, jobject thiz)
@@ -480,6 +554,18 @@ wseemann_media_FFmpegMediaPlayer_seekTo(JNIEnv *env, jobject thiz, int msec)
     process_media_player_call( env, thiz, mp->seekTo(msec), NULL, NULL );
 }
 
+static void
+wseemann_media_FFmpegMediaPlayer_seekToMode(JNIEnv *env, jobject thiz, jint msec, jint mode)
+{
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "seekTo: %d(msec), mode %d", msec, mode);
+    process_media_player_call( env, thiz, mp->seekTo(msec, mode), NULL, NULL );
+}
+
 static int
 wseemann_media_FFmpegMediaPlayer_getVideoWidth(JNIEnv *env, jobject thiz)
 {
@@ -705,6 +791,18 @@ wseemann_media_FFmpegMediaPlayer_native_init(JNIEnv *env)
         return;
     }
     
+    fields.post_render_audio = env->GetStaticMethodID(clazz, "postRenderAudioFromNative",
+                                                      "(Ljava/lang/Object;Ljava/nio/ByteBuffer;)V");
+    if (fields.post_render_audio == NULL) {
+        return;
+    }
+
+    fields.post_render_video = env->GetStaticMethodID(clazz, "postRenderVideoFromNative",
+                                                      "(Ljava/lang/Object;Ljava/nio/ByteBuffer;IIIJ)V");
+    if (fields.post_render_video == NULL) {
+        return;
+    }
+
     fields.surface_texture = env->GetFieldID(clazz, "mNativeSurfaceTexture", "I");
     if (fields.surface_texture == NULL) {
         return;
@@ -740,13 +838,16 @@ wseemann_media_FFmpegMediaPlayer_release(JNIEnv *env, jobject thiz)
     //decVideoSurfaceRef(env, thiz);
     MediaPlayer* mp = setMediaPlayer(env, thiz, 0);
     if (mp != NULL) {
+        // the render threads stop with the player, before their listener goes
+        mp->setRenderListener(0);
+        mp->disconnect();
         // this prevents native callbacks after the object is released
         JNIMediaPlayerListener *listener = (JNIMediaPlayerListener *) mp->getListener();
         delete listener;
         mp->setListener(0);
-        mp->disconnect();
         
-        delete mp;
+        // a player it was set as next of may still hold it
+        mp->decStrong();
         setMediaPlayer(env, thiz, 0);
     }
 }
@@ -805,10 +906,24 @@ static void wseemann_media_FFmpegMediaPlayer_attachAuxEffect(JNIEnv *env,  jobje
     process_media_player_call( env, thiz, mp->attachAuxEffect(effectId), NULL, NULL );
 }
 
+static void
+wseemann_media_FFmpegMediaPlayer_setRenderListener(JNIEnv *env, jobject thiz, jboolean enable)
+{
+    __android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "setRenderListener");
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return;
+    }
+    // the listener lives until release, after the render threads stopped
+    JNIMediaPlayerListener *listener = (JNIMediaPlayerListener *) mp->getListener();
+    process_media_player_call( env, thiz, mp->setRenderListener(enable ? listener : NULL), NULL, NULL );
+}
+
 static void
 wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer(JNIEnv *env, jobject thiz, jobject java_player)
 {
-    /*__android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "setNextMediaPlayer");
+    __android_log_write(ANDROID_LOG_VERBOSE, LOG_TAG, "setNextMediaPlayer");
     MediaPlayer* thisplayer = getMediaPlayer(env, thiz);
     if (thisplayer == NULL) {
         jniThrowException(env, "java/lang/IllegalStateException", "This player not initialized");
@@ -819,7 +934,7 @@ wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer(JNIEnv *env, jobject thiz, j
         jniThrowException(env, "java/lang/IllegalStateException", "That player not initialized");
         return;
     }
-    
+
     if (nextplayer == thisplayer) {
         jniThrowException(env, "java/lang/IllegalArgumentException", "Next player can't be self");
         return;
@@ -829,7 +944,57 @@ wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer(JNIEnv *env, jobject thiz, j
                               env, thiz, thisplayer->setNextMediaPlayer(nextplayer),
                               "java/lang/IllegalArgumentException",
                               "setNextMediaPlayer failed." );
-    ;*/
+}
+
+static jboolean
+wseemann_media_FFmpegMediaPlayer_setParameter(JNIEnv *env, jobject thiz, jint key, jint value)
+{
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setParameter: key %d, value %d", key, value);
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return false;
+    }
+    return mp->setParameter(key, value) == NO_ERROR;
+}
+
+static jboolean
+wseemann_media_FFmpegMediaPlayer_setStringParameter(JNIEnv *env, jobject thiz, jint key, jstring value)
+{
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return false;
+    }
+    if (value == NULL) {
+        jniThrowException(env, "java/lang/IllegalArgumentException", NULL);
+        return false;
+    }
+    const char *tmp = env->GetStringUTFChars(value, NULL);
+    if (tmp == NULL) {  // Out of memory
+        return false;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "setParameter: key %d, value %s", key, tmp);
+    status_t ret = mp->setParameter(key, tmp);
+    env->ReleaseStringUTFChars(value, tmp);
+    return ret == NO_ERROR;
+}
+
+static jint
+wseemann_media_FFmpegMediaPlayer_getIntParameter(JNIEnv *env, jobject thiz, jint key)
+{
+    MediaPlayer* mp = getMediaPlayer(env, thiz);
+    if (mp == NULL ) {
+        jniThrowException(env, "java/lang/IllegalStateException", NULL);
+        return 0;
+    }
+    int value;
+    if (0 != mp->getParameter(key, &value)) {
+        __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, "getParameter failed for key %d", key);
+        value = 0;
+    }
+    __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, "getParameter: key %d, value %d", key, value);
+    return value;
 }
 
 // ----------------------------------------------------------------------------
@@ -850,6 +1015,7 @@ static JNINativeMethod gMethods[] = {
     {"getVideoWidth",       "()I",                              (void *)wseemann_media_FFmpegMediaPlayer_getVideoWidth},
     {"getVideoHeight",      "()I",                              (void *)wseemann_media_FFmpegMediaPlayer_getVideoHeight},
     {"seekTo",              "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_seekTo},
+    {"_seekTo",             "(II)V",                            (void *)wseemann_media_FFmpegMediaPlayer_seekToMode},
     {"_pause",              "()V",                              (void *)wseemann_media_FFmpegMediaPlayer_pause},
     {"isPlaying",           "()Z",                              (void *)wseemann_media_FFmpegMediaPlayer_isPlaying},
     {"getCurrentPosition",  "()I",                              (void *)wseemann_media_FFmpegMediaPlayer_getCurrentPosition},
@@ -870,6 +1036,10 @@ static JNINativeMethod gMethods[] = {
     {"setAuxEffectSendLevel", "(F)V",                           (void *)wseemann_media_FFmpegMediaPlayer_setAuxEffectSendLevel},
     {"attachAuxEffect",     "(I)V",                             (void *)wseemann_media_FFmpegMediaPlayer_attachAuxEffect},
     {"setNextMediaPlayer", "(Lwseemann/media/FFmpegMediaPlayer;)V", (void *)wseemann_media_FFmpegMediaPlayer_setNextMediaPlayer},
+    {"_setRenderListener",  "(Z)V",                             (void *)wseemann_media_FFmpegMediaPlayer_setRenderListener},
+    {"_setParameter",       "(II)Z",                            (void *)wseemann_media_FFmpegMediaPlayer_setParameter},
+    {"_setStringParameter", "(ILjava/lang/String;)Z",           (void *)wseemann_media_FFmpegMediaPlayer_setStringParameter},
+    {"_getIntParameter",    "(I)I",                             (void *)wseemann_media_FFmpegMediaPlayer_getIntParameter},
 };
 
 static const char* const kClassPathName = "wseemann/media/FFmpegMediaPlayer";